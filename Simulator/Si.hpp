@@ -0,0 +1,950 @@
+#ifndef SI_HPP
+#define SI_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#include "../Assembler/cxxopts.hpp"
+#pragma GCC diagnostic pop
+#pragma GCC diagnostic pop
+
+#include "libs/aot.hpp"
+#include "libs/checkpoint.hpp"
+#include "libs/cost.hpp"
+#include "libs/coverage.hpp"
+#include "libs/gdb_stub.hpp"
+#include "libs/jit.hpp"
+#include "libs/lockstep.hpp"
+#include "libs/prefix_tree.hpp"
+#include "libs/profile.hpp"
+#include "libs/recording.hpp"
+#include "libs/sanitizer.hpp"
+#include "libs/simulator.hpp"
+#include "libs/statistics.hpp"
+#include "libs/trace.hpp"
+
+class Si {
+public:
+  Si(int argc, char **argv)
+      : argumentCount(argc), argumentValues(argv),
+        options("Si", "A simulator for the Assembly language") {
+    parse_options();
+  }
+
+  void parse_options() {
+    options.positional_help("<object files>");
+    options.add_options()("h,help", "Print this help message")(
+        "engine", "The execution engine to use (switch, threaded, jit)",
+        cxxopts::value<std::string>()->default_value("threaded"))(
+        "aot", "Compile the program to native code ahead of time, falling back "
+               "to the interpreter for self-modifying programs")(
+        "aot-cache", "Where to keep compiled programs",
+        cxxopts::value<std::string>())(
+        "lanes",
+        "Run the program once per line of the given file, using that line's "
+        "numbers as its input, many runs at a time",
+        cxxopts::value<std::string>())(
+        "share-prefixes",
+        "With --lanes, run the vectors one at a time instead, saving the "
+        "simulator at each IN so that input the vectors start with in common "
+        "is only run once (switch and threaded engines only)")(
+        "input",
+        "Run without prompting, reading all input up front from the given "
+        "file (- for standard input) and printing output as bare numbers when "
+        "the program stops, which exits with status 4 if it runs out of input "
+        "(not with --aot)",
+        cxxopts::value<std::string>())(
+        "fuse", "Fuse common instruction sequences (threaded engine only)")(
+        "accelerate-loops",
+        "Skip ahead through simple counting loops (switch and threaded "
+        "engines only)")(
+        "detect-loops",
+        "Stop, with exit status 2, once the program is provably stuck in an "
+        "infinite loop (switch and threaded engines only)")(
+        "max-instructions",
+        "Stop, with exit status 3, once the program has executed more than "
+        "this many instructions (switch and threaded engines only)",
+        cxxopts::value<uint64_t>())(
+        "timeout",
+        "Stop, with exit status 3, once the program has run for this many "
+        "seconds (switch and threaded engines only)",
+        cxxopts::value<double>())(
+        "count", "Print how many instructions the program executed "
+                 "(switch and threaded engines only)")(
+        "break",
+        "Report each time the program reaches the instruction at this address, "
+        "and carry on (threaded engine only, may be repeated)",
+        cxxopts::value<std::vector<uint16_t>>())(
+        "watch",
+        "Report each time the program is about to write the word at this "
+        "address, and carry on (threaded engine only, may be repeated)",
+        cxxopts::value<std::vector<uint16_t>>())(
+        "gdb",
+        "Wait for a debugger to connect over the GDB remote protocol, on this "
+        "port on localhost or Unix socket path, and run under its control "
+        "(threaded engine only)",
+        cxxopts::value<std::string>())(
+        "record",
+        "Save every value the program reads and writes, and when, to the "
+        "given file (switch and threaded engines only)",
+        cxxopts::value<std::string>())(
+        "replay",
+        "Run the program on the input saved by --record instead of asking for "
+        "it, stopping with exit status 5 where it first does I/O differently "
+        "(switch and threaded engines only)",
+        cxxopts::value<std::string>())(
+        "trace",
+        "Save which way every conditional jump goes, and every value read, to "
+        "the given file as the program runs (threaded engine only)",
+        cxxopts::value<std::string>())(
+        "expand-trace",
+        "Print every instruction a run saved with --trace executed, working "
+        "them out from the trace and the object file",
+        cxxopts::value<std::string>())(
+        "profile",
+        "Count how often each instruction runs and each data word is used, "
+        "and print the hottest lines, labels and loops, using the .lst and "
+        ".sym files beside the object file (switch and threaded engines only)")(
+        "sanitize",
+        "Report each instruction that reads a data word before anything gives "
+        "it a value, with its line from the .lst file beside the object file, "
+        "and exit with status 6 if any do (threaded engine only)")(
+        "stats",
+        "Write statistics for each run to the given file: instructions by "
+        "opcode, jumps taken and not, I/O, data words used and speed (switch "
+        "and threaded engines only)",
+        cxxopts::value<std::string>())(
+        "stats-format", "The format to write statistics in (json, openmetrics)",
+        cxxopts::value<std::string>()->default_value("json"))(
+        "coverage",
+        "Save which addresses the program executed, and which ways its jumps "
+        "went, to the given file (switch and threaded engines only)",
+        cxxopts::value<std::string>())(
+        "merge-coverage",
+        "Merge the coverage files given in place of object files into the "
+        "given file",
+        cxxopts::value<std::string>())(
+        "coverage-report",
+        "Print the object file's listing marked with what the coverage in the "
+        "given file ran, using the .lst file beside it",
+        cxxopts::value<std::string>())(
+        "costs",
+        "Charge each instruction the cycles its opcode takes in the given "
+        "file, and print the cycles the program took and where (switch and "
+        "threaded engines only)",
+        cxxopts::value<std::string>())(
+        "fusion-report",
+        "Print how often each fused sequence ran (implies --fuse)")(
+        "checkpoint",
+        "Save the simulator's state to the given file every so often, and "
+        "when the program halts (switch and threaded engines only)",
+        cxxopts::value<std::string>())(
+        "checkpoint-every", "How many instructions to run between checkpoints",
+        cxxopts::value<uint64_t>()->default_value("100000000"))(
+        "resume", "Carry on from a checkpoint instead of running object files",
+        cxxopts::value<std::string>())(
+        "files", "The object files to run",
+        cxxopts::value<std::vector<std::string>>());
+  }
+
+  // Runs every object file given, or carries on from a checkpoint, and
+  // returns the exit status.
+  int simulate() {
+    if (const auto status = read_options()) {
+      return *status;
+    }
+    if (!valid()) {
+      return 1;
+    }
+
+    // Merging ORs the coverage files together and stops there.
+    if (!merged.empty()) {
+      return merge_coverage();
+    }
+
+    if (!load_inputs()) {
+      return 1;
+    }
+
+    if (!resume.empty()) {
+      Simulator sim{};
+      if (!load_checkpoint(sim, resume)) {
+        std::cerr << "Couldn't resume from '" << resume << "'\n";
+        return 1;
+      }
+      return finish(execute(sim, {}, resume));
+    }
+
+    for (auto &&file_name : files) {
+      if (const int status = run_file(file_name); status != 0) {
+        return finish(status);
+      }
+    }
+    return finish(0);
+  }
+
+private:
+  int argumentCount;
+  char **argumentValues;
+  cxxopts::Options options;
+
+  std::vector<std::string> files;
+  std::string engine;
+  bool weShouldCompile{false};
+  std::filesystem::path cache;
+  std::string lanes;
+  bool weShouldSharePrefixes{false};
+  std::string tape;
+  bool weShouldFuse{false};
+  bool weShouldAccelerate{false};
+  bool weShouldDetectLoops{false};
+  std::optional<uint64_t> budget;
+  std::optional<double> timeout;
+  bool weShouldCount{false};
+  std::vector<uint16_t> breakpoints;
+  std::vector<uint16_t> watchpoints;
+  std::string gdb;
+  std::string record;
+  std::string replay;
+  std::string traced;
+  std::string expanded;
+  bool weShouldProfile{false};
+  bool weShouldSanitize{false};
+  std::string stats;
+  std::string format;
+  std::string coverage;
+  std::string merged;
+  std::string covered;
+  std::string costs;
+  bool weShouldReportFusions{false};
+  std::string checkpoint;
+  uint64_t interval{1};
+  std::string resume;
+
+  CostModel model;
+  Recording recorded;
+  // The whole of the input tape, parsed in one go.
+  std::vector<int16_t> taped;
+  std::vector<Statistics> statistics;
+
+  // Reads the options into the members above. Returns the exit status, if
+  // there's nothing more to do.
+  std::optional<int> read_options() {
+    try {
+      options.parse_positional("files");
+      auto parsed = options.parse(argumentCount, argumentValues);
+
+      if (parsed["help"].as<bool>()) {
+        std::cout << options.help() << '\n';
+        return 0;
+      }
+
+      if (parsed.count("resume") != 0) {
+        resume = parsed["resume"].as<std::string>();
+      } else if (0 == parsed.count("files")) {
+        std::cerr << "No input files\n";
+        return 1;
+      } else {
+        files = parsed["files"].as<std::vector<std::string>>();
+      }
+
+      engine = parsed["engine"].as<std::string>();
+      weShouldCompile = parsed["aot"].as<bool>();
+      cache = parsed.count("aot-cache") != 0
+                  ? std::filesystem::path(parsed["aot-cache"].as<std::string>())
+                  : Aot::default_cache_directory();
+      if (parsed.count("lanes") != 0) {
+        lanes = parsed["lanes"].as<std::string>();
+      }
+      weShouldSharePrefixes = parsed["share-prefixes"].as<bool>();
+      if (parsed.count("input") != 0) {
+        tape = parsed["input"].as<std::string>();
+      }
+      weShouldProfile = parsed["profile"].as<bool>();
+      weShouldSanitize = parsed["sanitize"].as<bool>();
+      if (parsed.count("stats") != 0) {
+        stats = parsed["stats"].as<std::string>();
+      }
+      format = parsed["stats-format"].as<std::string>();
+      if (parsed.count("coverage") != 0) {
+        coverage = parsed["coverage"].as<std::string>();
+      }
+      if (parsed.count("merge-coverage") != 0) {
+        merged = parsed["merge-coverage"].as<std::string>();
+      }
+      if (parsed.count("coverage-report") != 0) {
+        covered = parsed["coverage-report"].as<std::string>();
+      }
+      if (parsed.count("costs") != 0) {
+        costs = parsed["costs"].as<std::string>();
+      }
+      weShouldReportFusions = parsed["fusion-report"].as<bool>();
+      weShouldFuse = parsed["fuse"].as<bool>() || weShouldReportFusions;
+      weShouldAccelerate = parsed["accelerate-loops"].as<bool>();
+      weShouldDetectLoops = parsed["detect-loops"].as<bool>();
+      if (parsed.count("max-instructions") != 0) {
+        budget = parsed["max-instructions"].as<uint64_t>();
+      }
+      if (parsed.count("timeout") != 0) {
+        timeout = parsed["timeout"].as<double>();
+      }
+      weShouldCount = parsed["count"].as<bool>();
+      if (parsed.count("break") != 0) {
+        breakpoints = parsed["break"].as<std::vector<uint16_t>>();
+      }
+      if (parsed.count("watch") != 0) {
+        watchpoints = parsed["watch"].as<std::vector<uint16_t>>();
+      }
+      if (parsed.count("gdb") != 0) {
+        gdb = parsed["gdb"].as<std::string>();
+      }
+      if (parsed.count("record") != 0) {
+        record = parsed["record"].as<std::string>();
+      }
+      if (parsed.count("replay") != 0) {
+        replay = parsed["replay"].as<std::string>();
+      }
+      if (parsed.count("trace") != 0) {
+        traced = parsed["trace"].as<std::string>();
+      }
+      if (parsed.count("expand-trace") != 0) {
+        expanded = parsed["expand-trace"].as<std::string>();
+      }
+      if (parsed.count("checkpoint") != 0) {
+        checkpoint = parsed["checkpoint"].as<std::string>();
+      }
+      interval =
+          std::max<uint64_t>(parsed["checkpoint-every"].as<uint64_t>(), 1);
+    } catch (const cxxopts::OptionParseException &e) {
+      std::cerr << e.what() << '\n' << options.help();
+      return 1;
+    }
+    return std::nullopt;
+  }
+
+  // Whether the options make sense together, saying why not if they don't.
+  bool valid() const {
+    if (engine != "switch" && engine != "threaded" && engine != "jit") {
+      std::cerr << "Unknown engine '" << engine << "'\n";
+      return false;
+    }
+
+    if (weShouldSharePrefixes &&
+        (lanes.empty() || engine == "jit" || weShouldCompile)) {
+      std::cerr << "--share-prefixes needs --lanes and the switch or threaded "
+                   "engine\n";
+      return false;
+    }
+
+    if ((weShouldDetectLoops || budget || timeout || weShouldCount) &&
+        (engine == "jit" || weShouldCompile || !lanes.empty())) {
+      std::cerr << "--detect-loops, --max-instructions, --timeout and --count "
+                   "need the switch or threaded engine\n";
+      return false;
+    }
+
+    if ((!breakpoints.empty() || !watchpoints.empty()) &&
+        (engine != "threaded" || weShouldCompile || !lanes.empty())) {
+      std::cerr << "--break and --watch need the threaded engine\n";
+      return false;
+    }
+
+    if (!gdb.empty() && (engine != "threaded" || weShouldCompile ||
+                         !lanes.empty() || !checkpoint.empty())) {
+      std::cerr << "--gdb needs the threaded engine, and can't be used with "
+                   "--checkpoint\n";
+      return false;
+    }
+
+    if ((!record.empty() || !replay.empty()) &&
+        (engine == "jit" || weShouldCompile || !lanes.empty() ||
+         !resume.empty() || !gdb.empty() || files.size() > 1)) {
+      std::cerr << "--record and --replay need the switch or threaded engine "
+                   "and one object file, and can't be used with --gdb\n";
+      return false;
+    }
+
+    if (!replay.empty() && (!record.empty() || !tape.empty())) {
+      std::cerr << "--replay can't be used with --record or --input\n";
+      return false;
+    }
+
+    if (!traced.empty() &&
+        (engine != "threaded" || weShouldCompile || !lanes.empty() ||
+         !resume.empty() || !gdb.empty())) {
+      std::cerr << "--trace needs the threaded engine, and can't be used with "
+                   "--resume or --gdb\n";
+      return false;
+    }
+
+    if (!expanded.empty() && (files.size() != 1 || !traced.empty())) {
+      std::cerr << "--expand-trace takes one object file\n";
+      return false;
+    }
+
+    if (weShouldProfile &&
+        (engine == "jit" || weShouldCompile || !lanes.empty() ||
+         !resume.empty() || !gdb.empty() || !checkpoint.empty() ||
+         !traced.empty() || !expanded.empty() || !breakpoints.empty() ||
+         !watchpoints.empty())) {
+      std::cerr << "--profile needs the switch or threaded engine, and can't "
+                   "be used with --resume, --gdb, --checkpoint, --trace, "
+                   "--break or --watch\n";
+      return false;
+    }
+
+    if (weShouldSanitize &&
+        (engine != "threaded" || weShouldCompile || !lanes.empty() ||
+         !resume.empty() || !gdb.empty() || !checkpoint.empty() ||
+         !traced.empty() || !expanded.empty() || !breakpoints.empty() ||
+         !watchpoints.empty() || weShouldProfile)) {
+      std::cerr << "--sanitize needs the threaded engine, and can't be used "
+                   "with --resume, --gdb, --checkpoint, --trace, --break, "
+                   "--watch or --profile\n";
+      return false;
+    }
+
+    if (format != "json" && format != "openmetrics") {
+      std::cerr << "Unknown statistics format '" << format << "'\n";
+      return false;
+    }
+
+    if (!stats.empty() &&
+        (engine == "jit" || weShouldCompile || !lanes.empty() ||
+         !gdb.empty() || !expanded.empty())) {
+      std::cerr << "--stats needs the switch or threaded engine, and can't be "
+                   "used with --gdb\n";
+      return false;
+    }
+
+    if (!coverage.empty() &&
+        (engine == "jit" || weShouldCompile || !lanes.empty() ||
+         !resume.empty() || !gdb.empty() || files.size() != 1)) {
+      std::cerr << "--coverage needs the switch or threaded engine and one "
+                   "object file, and can't be used with --resume or --gdb\n";
+      return false;
+    }
+
+    if (!costs.empty() &&
+        (engine == "jit" || weShouldCompile || !lanes.empty() ||
+         !gdb.empty() || !expanded.empty())) {
+      std::cerr << "--costs needs the switch or threaded engine, and can't be "
+                   "used with --gdb\n";
+      return false;
+    }
+
+    if (!covered.empty() && (files.size() != 1 || !coverage.empty())) {
+      std::cerr << "--coverage-report takes one object file\n";
+      return false;
+    }
+
+    if (!checkpoint.empty() &&
+        (engine == "jit" || weShouldCompile || !lanes.empty())) {
+      std::cerr << "--checkpoint needs the switch or threaded engine\n";
+      return false;
+    }
+
+    if (!resume.empty() &&
+        (!files.empty() || weShouldCompile || !lanes.empty())) {
+      std::cerr
+          << "--resume can't be used with object files, --aot or --lanes\n";
+      return false;
+    }
+
+    if (!tape.empty() &&
+        (weShouldCompile || !lanes.empty() || !resume.empty())) {
+      std::cerr << "--input can't be used with --aot, --lanes or --resume\n";
+      return false;
+    }
+    return true;
+  }
+
+  // Merges the coverage files given in place of object files.
+  int merge_coverage() const {
+    Coverage total;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+      Coverage run;
+      if (!load_coverage(run, files[i])) {
+        std::cerr << "Couldn't read coverage '" << files[i] << "'\n";
+        return 1;
+      }
+      if (i != 0 && run.program != total.program) {
+        std::cerr << "Coverage '" << files[i] << "' is of another program\n";
+        return 1;
+      }
+      total.program = run.program;
+      total.merge(run);
+    }
+    if (!save_coverage(total, merged)) {
+      std::cerr << "Couldn't write coverage '" << merged << "'\n";
+      return 1;
+    }
+    return 0;
+  }
+
+  // Reads the cost model, the recording to replay and the input tape, if
+  // they were given.
+  bool load_inputs() {
+    if (!costs.empty() && !load_costs(model, costs)) {
+      std::cerr << "Couldn't read costs '" << costs << "'\n";
+      return false;
+    }
+
+    if (!replay.empty() && !load_recording(recorded, replay)) {
+      std::cerr << "Couldn't read recording '" << replay << "'\n";
+      return false;
+    }
+
+    return tape.empty() || read_tape();
+  }
+
+  // Reads the whole of the input tape in one go.
+  bool read_tape() {
+    std::ifstream file;
+    if (tape != "-") {
+      file.open(tape, std::ios::binary);
+    }
+    std::istream &stream = tape == "-" ? std::cin : file;
+    const std::string text(std::istreambuf_iterator<char>(stream), {});
+    if (!stream.good() && !stream.eof()) {
+      std::cerr << "Couldn't read input '" << tape << "'\n";
+      return false;
+    }
+
+    const char *at = text.data();
+    const char *const end = at + text.size();
+    for (;;) {
+      while (at != end && std::isspace(static_cast<unsigned char>(*at))) {
+        ++at;
+      }
+      if (at == end) {
+        break;
+      }
+      int16_t value = 0;
+      const auto [next, error] = std::from_chars(at, end, value);
+      if (error != std::errc() ||
+          (next != end && !std::isspace(static_cast<unsigned char>(*next)))) {
+        std::cerr << "Bad number in input '" << tape << "'\n";
+        return false;
+      }
+      taped.push_back(value);
+      at = next;
+    }
+    return true;
+  }
+
+  // Runs the object file, or does whatever else was asked of it, and
+  // returns the exit status.
+  int run_file(const std::string &file_name) {
+    const auto image = load_image(file_name);
+
+    if (!expanded.empty()) {
+      return expand_trace(image, expanded, std::cout) ? 0 : 1;
+    }
+
+    if (!covered.empty()) {
+      Coverage run;
+      if (!load_coverage(run, covered)) {
+        std::cerr << "Couldn't read coverage '" << covered << "'\n";
+        return 1;
+      }
+      if (run.program != Coverage::fingerprint(image)) {
+        std::cerr << "Coverage '" << covered << "' is of another program\n";
+        return 1;
+      }
+      report_coverage(run, image, Listing::beside(file_name), std::cout);
+      return 0;
+    }
+
+    if (!lanes.empty()) {
+      return run_lanes(image);
+    }
+
+    Simulator sim{};
+    sim.fill(image);
+    return execute(sim, image, file_name);
+  }
+
+  static std::vector<uint16_t> load_image(const std::string &file_name) {
+    std::ifstream file(file_name, std::ios::binary);
+
+    std::vector<unsigned char> buff(std::istreambuf_iterator<char>(file), {});
+
+    std::vector<uint16_t> image(
+        std::min<std::size_t>(buff.size() / 2, 0xFFFF));
+    for (std::size_t i = 0; i < image.size(); i++) {
+      image[i] = (buff[i * 2] << 8) | buff[i * 2 + 1];
+    }
+    return image;
+  }
+
+  // Runs the program once for each line of the --lanes file, with the
+  // numbers on it as input, and prints how each run ended and its output.
+  int run_lanes(const std::vector<uint16_t> &image) const {
+    std::vector<std::vector<int16_t>> inputs;
+    std::ifstream vectors(lanes);
+    for (std::string line; std::getline(vectors, line);) {
+      std::istringstream values(line);
+      inputs.emplace_back(std::istream_iterator<int16_t>(values),
+                          std::istream_iterator<int16_t>());
+    }
+
+    if (weShouldSharePrefixes) {
+      Simulator sim{};
+      sim.fill(image);
+      sim.enable_fusion(weShouldFuse);
+      sim.enable_loop_acceleration(weShouldAccelerate);
+
+      PrefixTree tree(std::move(inputs));
+      tree.run(std::move(sim), [&](Simulator &run) {
+        if (engine == "switch") {
+          run.run();
+        } else {
+          run.run_threaded();
+        }
+      });
+
+      for (std::size_t lane = 0; lane < tree.runs().size(); ++lane) {
+        const auto &result = tree.runs()[lane];
+        report(lane, result.status == PrefixTree::Status::HALTED,
+               result.output);
+      }
+      return 0;
+    }
+
+#if defined(SIMULATOR_HAS_LOCKSTEP)
+    Lockstep lockstep(image, std::move(inputs));
+    lockstep.run();
+
+    for (std::size_t lane = 0; lane < lockstep.lanes().size(); ++lane) {
+      const auto &result = lockstep.lanes()[lane];
+      report(lane, result.status == Lockstep::Status::HALTED, result.output);
+    }
+    return 0;
+#else
+    std::cerr << "--lanes isn't supported by this compiler\n";
+    return 1;
+#endif
+  }
+
+  static void report(std::size_t lane, bool halted,
+                     const std::vector<int16_t> &output) {
+    std::cout << "(Lane " << std::setw(9) << std::left << lane << std::right
+              << ") => " << (halted ? "halted" : "waiting for input") << '\n';
+    for (const auto value : output) {
+      std::cout << "(Output        ) => " << value << '\n';
+    }
+  }
+
+  // Writes out the statistics, if asked for, on the way out with status.
+  int finish(int status) const {
+    if (!stats.empty() && !save_statistics(statistics, format, stats)) {
+      std::cerr << "Couldn't write statistics '" << stats << "'\n";
+      return status == 0 ? 1 : status;
+    }
+    return status;
+  }
+
+  // Runs a simulator with the chosen engine, saving checkpoints as it goes
+  // if asked to, and reports on the run. Returns the exit status.
+  int execute(Simulator &sim, const std::vector<uint16_t> &image,
+              const std::string &name) {
+    configure(sim);
+    std::optional<TraceWriter> writer;
+    if (!traced.empty()) {
+      writer.emplace(traced);
+      sim.trace_control_flow(
+          [&writer](const uint64_t *words, std::size_t count) {
+            writer->write(words, count);
+          });
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    if (const auto status = run_engine(sim, image, name)) {
+      return *status;
+    }
+
+    if (!stats.empty()) {
+      const std::chrono::duration<double> took =
+          std::chrono::steady_clock::now() - started;
+      statistics.push_back(Statistics::of(sim, name, took.count()));
+    }
+
+    if (!coverage.empty() &&
+        !save_coverage(Coverage::of(sim, image), coverage)) {
+      std::cerr << "Couldn't write coverage '" << coverage << "'\n";
+      return 1;
+    }
+
+    if (writer) {
+      sim.finish_trace();
+      if (!writer->close()) {
+        std::cerr << "Couldn't write trace '" << traced << "'\n";
+        return 1;
+      }
+    }
+
+    return report(sim, image, name);
+  }
+
+  // Sets the simulator up as the options ask.
+  void configure(Simulator &sim) const {
+    sim.enable_fusion(weShouldFuse);
+    sim.enable_loop_acceleration(weShouldAccelerate);
+    sim.detect_loops(weShouldDetectLoops);
+    if (!tape.empty()) {
+      sim.feed(taped);
+      sim.capture_output();
+    }
+    if (budget) {
+      sim.limit_instructions(*budget);
+    }
+    if (timeout) {
+      sim.limit_time(std::chrono::steady_clock::now() +
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::duration<double>(*timeout)));
+    }
+    for (const auto address : breakpoints) {
+      sim.set_breakpoint(address);
+    }
+    for (const auto address : watchpoints) {
+      sim.watch(address);
+    }
+    if (!record.empty()) {
+      sim.record_io();
+    }
+    if (!replay.empty()) {
+      sim.replay_io(recorded.events);
+      sim.capture_output();
+    }
+    if (!stats.empty() || !coverage.empty() || !costs.empty() ||
+        weShouldProfile) {
+      sim.count_jumps();
+    }
+    if (weShouldSanitize) {
+      sim.sanitize();
+    }
+  }
+
+  // Runs the simulator with the chosen engine. Returns the exit status if
+  // the run can't be reported on.
+  std::optional<int> run_engine(Simulator &sim,
+                                const std::vector<uint16_t> &image,
+                                const std::string &name) const {
+    if (!checkpoint.empty()) {
+      while (!sim.halted() && !sim.infinite_loop() && !sim.out_of_budget() &&
+             !sim.out_of_time() && !sim.waiting_for_input() &&
+             !sim.diverged()) {
+        sim.pause_after(sim.instructions() + interval);
+        if (engine == "switch") {
+          sim.run();
+        } else {
+          run_threaded(sim, name);
+        }
+
+        if (!save_checkpoint(sim, checkpoint)) {
+          std::cerr << "Couldn't write checkpoint '" << checkpoint << "'\n";
+          return 1;
+        }
+      }
+    } else if (!gdb.empty()) {
+      GdbStub stub(sim);
+      if (!stub.listen(gdb)) {
+        return 1;
+      }
+      // Once the debugger detaches, the program runs on without it. Killed,
+      // it's left where it was.
+      const bool detached = stub.serve();
+      if (!sim.halted()) {
+        if (!detached) {
+          return 0;
+        }
+        run_threaded(sim, name);
+      }
+    } else if (weShouldCompile) {
+      if (!Aot(sim, cache).run(image)) {
+        sim.run();
+      }
+    } else if (engine == "switch") {
+      sim.run();
+    } else if (engine == "jit") {
+      Jit(sim).run();
+    } else {
+      run_threaded(sim, name);
+    }
+
+    return std::nullopt;
+  }
+
+  // Runs the threaded engine, reporting every breakpoint and watchpoint it
+  // stops at on the way.
+  static void run_threaded(Simulator &sim, const std::string &name) {
+    sim.run_threaded();
+    while (const auto &hit = sim.hit()) {
+      std::cerr << name << ": " << std::hex << std::setfill('0')
+                << std::setw(4) << sim.program_counter();
+      if (hit->kind == Simulator::Hit::BREAKPOINT) {
+        std::cerr << " breakpoint";
+      } else {
+        std::cerr << " about to write " << std::setw(4) << hit->address;
+      }
+      std::cerr << std::dec << std::setfill(' ')
+                << ", R = " << static_cast<int16_t>(sim.accumulator())
+                << ", after " << sim.instructions() << " instructions\n";
+      sim.run_threaded();
+    }
+  }
+
+  // Prints whatever was asked for about a finished run, and returns the
+  // exit status.
+  int report(const Simulator &sim, const std::vector<uint16_t> &image,
+             const std::string &name) const {
+    if (weShouldReportFusions) {
+      std::cerr << name << ": fused sequences executed\n";
+      for (int i = 0; i < Simulator::FUSIONS; ++i) {
+        const auto fusion = static_cast<Simulator::Fusion>(i);
+        std::cerr << "  " << std::setw(36) << std::left
+                  << Simulator::fusion_name(fusion) << std::right
+                  << std::setw(12) << sim.fusions()[fusion] << '\n';
+      }
+    }
+
+    if (weShouldProfile) {
+      std::cerr << name << ": profile\n";
+      report_profile(Profile::of(sim), image, Listing::beside(name),
+                     sim.instructions(), std::cerr);
+    }
+
+    if (!sim.uninitialized_reads().empty()) {
+      std::cerr << name << ": read uninitialized memory\n";
+      report_uninitialized(sim.uninitialized_reads(), Listing::beside(name),
+                           std::cerr);
+    }
+
+    if (!tape.empty() || !replay.empty()) {
+      const auto &values = sim.captured_output();
+      std::string buffer(values.size() * 7, '\0');
+      char *at = buffer.data();
+      for (const auto value : values) {
+        at = std::to_chars(at, buffer.data() + buffer.size(), value).ptr;
+        *at++ = '\n';
+      }
+      std::cout.write(buffer.data(), at - buffer.data());
+      std::cout.flush();
+    }
+
+    if (weShouldCount) {
+      std::cerr << name << ": " << sim.instructions()
+                << " instructions executed\n";
+    }
+
+    if (!costs.empty()) {
+      const auto cycles = Cycles::of(sim, model);
+      std::cerr << name << ": " << cycles.total << " cycles\n";
+      report_cycles(cycles, sim, Listing::beside(name), std::cerr);
+    }
+
+    if (!record.empty() &&
+        !save_recording({sim.io_record(), sim.instructions()}, record)) {
+      std::cerr << "Couldn't write recording '" << record << "'\n";
+      return 1;
+    }
+
+    if (!replay.empty() && !replayed_faithfully(sim, name)) {
+      return 5;
+    }
+
+    if (sim.out_of_budget() || sim.out_of_time()) {
+      std::cerr << name << ": stopped after " << sim.instructions()
+                << " instructions, "
+                << (sim.out_of_time() ? "out of time" : "over budget") << '\n';
+      return 3;
+    }
+
+    if (sim.waiting_for_input()) {
+      std::cerr << name << ": ran out of input after " << sim.instructions()
+                << " instructions\n";
+      return 4;
+    }
+
+    if (const auto &loop = sim.infinite_loop()) {
+      std::cerr << name << ": infinite loop at " << std::hex
+                << std::setfill('0') << std::setw(4) << loop->first << "-"
+                << std::setw(4) << loop->last << std::dec << std::setfill(' ')
+                << " after " << sim.instructions() << " instructions\n";
+      return 2;
+    }
+
+    if (!sim.uninitialized_reads().empty()) {
+      return 6;
+    }
+    return 0;
+  }
+
+  // Whether the run did the I/O the recording did, saying where it first
+  // didn't if not.
+  bool replayed_faithfully(const Simulator &sim,
+                           const std::string &name) const {
+    const auto &events = recorded.events;
+    const auto describe = [](bool output, int16_t value, uint64_t at) {
+      std::ostringstream text;
+      text << (output ? "OUT " : "IN ");
+      if (output) {
+        text << value << ' ';
+      }
+      text << "at instruction " << at;
+      return text.str();
+    };
+
+    std::string happened;
+    std::optional<std::size_t> missed = sim.diverged();
+    if (missed) {
+      const MicroOp op{sim.memory(sim.program_counter())};
+      const bool output = op.opcode == (Simulator::OUT >> 12);
+      happened = describe(output,
+                          static_cast<int16_t>(sim.memory(op.operand)),
+                          sim.instructions());
+    } else if (sim.replayed_io() < events.size()) {
+      missed = sim.replayed_io();
+      happened = "stopped after " + std::to_string(sim.instructions()) +
+                 " instructions";
+    } else if (sim.instructions() != recorded.instructions) {
+      happened = "stopped after " + std::to_string(sim.instructions()) +
+                 " instructions, not " +
+                 std::to_string(recorded.instructions);
+    }
+
+    if (!happened.empty()) {
+      std::cerr << name << ": diverged from the recording: ";
+      if (missed) {
+        std::cerr << "expected "
+                  << (*missed < events.size()
+                          ? describe(events[*missed].output,
+                                     events[*missed].value,
+                                     events[*missed].instruction)
+                          : "no more I/O")
+                  << ", ";
+      }
+      std::cerr << happened << '\n';
+      return false;
+    }
+    return true;
+  }
+};
+
+#endif // SI_HPP
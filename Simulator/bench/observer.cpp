@@ -0,0 +1,210 @@
+// Times run() with the null observer, run() with an observer that counts
+// everything and the threaded engine, with and without fusion, against
+// run() as it was before any of them (see baseline.hpp): on one long run,
+// and on many short ones, where the time taken to get ready to run counts.
+// Between short runs the simulator is reset(), except for the baseline,
+// which can't be and makes a new one each time. With --gate, exits with
+// status 1 if any of them is slower than its floor below.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../libs/simulator.hpp"
+#include "baseline.hpp"
+
+namespace {
+
+struct CountingObserver : NullObserver {
+  uint64_t instructions{0};
+  uint64_t reads{0};
+  uint64_t writes{0};
+  uint64_t branches{0};
+
+  void instruction(uint16_t, uint16_t) { ++instructions; }
+  void read(uint16_t, uint16_t) { ++reads; }
+  void write(uint16_t, uint16_t) { ++writes; }
+  void branch(uint16_t, uint16_t) { ++branches; }
+};
+
+// Counts n down from 60000 to 0, 200 times over.
+const std::vector<uint16_t> LONG = {
+    0x000E, // 0:  LOAD n
+    0x500F, //     SUBTRACT one
+    0x100E, //     STORE n
+    0x7010, //     COMPARE zero
+    0xC000, //     JUMPNEQ 0
+    0x0011, // 5:  LOAD count
+    0x500F, //     SUBTRACT one
+    0x1011, //     STORE count
+    0x7010, //     COMPARE zero
+    0xA00D, //     JUMPEQ 13
+    0x0012, // 10: LOAD init
+    0x100E, //     STORE n
+    0x8000, //     JUMP 0
+    0xF000, // 13: HALT
+    60000,  // 14: n
+    1,      // 15: one
+    0,      // 16: zero
+    200,    // 17: count
+    60000,  // 18: init
+};
+
+// The same, counting down from 100 twice.
+const std::vector<uint16_t> SHORT = [] {
+  auto program = LONG;
+  program[14] = 100;
+  program[17] = 2;
+  program[18] = 100;
+  return program;
+}();
+
+// How many short runs are timed together.
+constexpr int SHORT_RUNS = 2000;
+
+constexpr int REPEATS = 5;
+
+// Something to time, which returns how many instructions it ran, and the
+// least speedup over the baseline --gate accepts. The floors leave room
+// for the noise of a shared machine, not for any real slowdown.
+struct Timed {
+  const char *name;
+  std::function<uint64_t()> run;
+  double floor;
+  double best;
+};
+
+// Times each of timed REPEATS times, round-robin so that they all see the
+// same load on the machine, and keeps the best of each in nanoseconds per
+// instruction.
+void time(std::vector<Timed> &timed) {
+  for (int i = 0; i < REPEATS; ++i) {
+    for (auto &each : timed) {
+      const auto start = std::chrono::steady_clock::now();
+      const uint64_t instructions = each.run();
+      const std::chrono::duration<double, std::nano> elapsed =
+          std::chrono::steady_clock::now() - start;
+      const double ns = elapsed.count() / static_cast<double>(instructions);
+      each.best = i == 0 ? ns : std::min(each.best, ns);
+    }
+  }
+}
+
+// The engines, each running program runs times, with the floors for
+// --gate for long and short runs.
+std::vector<Timed> engines(const std::vector<uint16_t> &program, int runs,
+                           bool short_runs, uint64_t executed) {
+  return {
+      {"baseline run()   ",
+       [&program, runs, executed] {
+         for (int i = 0; i < runs; ++i) {
+           auto sim = std::make_unique<baseline::Simulator>();
+           sim->fill(program);
+           sim->run();
+         }
+         return executed * runs;
+       },
+       0, 0},
+      {"null observer    ",
+       [&program, runs] {
+         Simulator sim{};
+         sim.fill(program);
+         uint64_t instructions = 0;
+         for (int i = 0; i < runs; ++i) {
+           sim.run();
+           instructions += sim.instructions();
+           sim.reset();
+         }
+         return instructions;
+       },
+       0.85, 0},
+      {"counting observer",
+       [&program, runs] {
+         BasicSimulator<CountingObserver> sim{};
+         sim.fill(program);
+         uint64_t instructions = 0;
+         for (int i = 0; i < runs; ++i) {
+           sim.run();
+           instructions += sim.instructions();
+           sim.reset();
+         }
+         return instructions;
+       },
+       0, 0},
+      {"run_threaded()   ",
+       [&program, runs] {
+         Simulator sim{};
+         sim.fill(program);
+         uint64_t instructions = 0;
+         for (int i = 0; i < runs; ++i) {
+           sim.run_threaded();
+           instructions += sim.instructions();
+           sim.reset();
+         }
+         return instructions;
+       },
+       short_runs ? 1.4 : 1.1, 0},
+      {"fused            ",
+       [&program, runs] {
+         Simulator sim{};
+         sim.fill(program);
+         sim.enable_fusion();
+         uint64_t instructions = 0;
+         for (int i = 0; i < runs; ++i) {
+           sim.run_threaded();
+           instructions += sim.instructions();
+           sim.reset();
+         }
+         return instructions;
+       },
+       1.8, 0},
+  };
+}
+
+// Times the engines on runs of program, and prints how they compare with
+// the baseline. Returns whether any is slower than its floor, when gating.
+bool compare(const std::vector<uint16_t> &program, int runs, bool short_runs,
+             bool gate) {
+  // The baseline doesn't count, but runs the same instructions.
+  BasicSimulator<CountingObserver> counter{};
+  counter.fill(program);
+  counter.run();
+  const CountingObserver &counted = counter.observer();
+  const uint64_t executed = counter.instructions();
+
+  std::vector<Timed> timed = engines(program, runs, short_runs, executed);
+  time(timed);
+
+  std::cout << "run() " << runs << (runs == 1 ? " time" : " times") << " on "
+            << counted.instructions << " instructions (" << counted.reads
+            << " reads, " << counted.writes << " writes, " << counted.branches
+            << " branches taken)\n";
+  const double baseline = timed.front().best;
+  bool slow = false;
+  for (const auto &each : timed) {
+    const double speedup = baseline / each.best;
+    std::cout << "  " << each.name << ": " << each.best
+              << " ns/instruction (" << 1000 / each.best
+              << " M instructions/s, " << speedup << "x baseline)";
+    if (gate && speedup < each.floor) {
+      std::cout << " slower than " << each.floor << "x";
+      slow = true;
+    }
+    std::cout << '\n';
+  }
+  return slow;
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  const bool gate = argc > 1 && std::strcmp(argv[1], "--gate") == 0;
+  const bool slow_long = compare(LONG, 1, false, gate);
+  const bool slow_short = compare(SHORT, SHORT_RUNS, true, gate);
+  return slow_long || slow_short ? 1 : 0;
+}
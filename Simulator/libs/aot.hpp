@@ -0,0 +1,389 @@
+#ifndef AOT_HPP
+#define AOT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "simulator.hpp"
+
+// Translates a program image into C with one label per reachable address
+// and goto-based control flow, compiles it into a shared object with the
+// system compiler and runs it natively. Shared objects are kept in a
+// content-addressed cache, keyed by a hash of the image, so the compile is
+// only paid for the first run of a given program.
+//
+// Operands are immediate, so every address a program can write to is known
+// statically. An image with a reachable instruction that writes into
+// reachable code is self-modifying and is never translated; nor is
+// anything outside the image. run() reports when it couldn't run the
+// program (or left it part way through), and the caller carries on with an
+// interpreter from the simulator's current state.
+class Aot {
+public:
+  Aot(Simulator &simulator, std::filesystem::path cache_directory)
+      : sim(simulator), cache(std::move(cache_directory)) {}
+
+  Aot(const Aot &) = delete;
+  Aot &operator=(const Aot &) = delete;
+
+  ~Aot() {
+    if (library != nullptr) {
+      dlclose(library);
+    }
+  }
+
+  // Runs the program natively for as long as it stays inside translated
+  // code. Returns whether it ran to a HALT.
+  bool run(const std::vector<uint16_t> &image) {
+    if (sim.halted()) {
+      return true;
+    }
+
+    Entry entry = load(image);
+    if (entry == nullptr) {
+      return false;
+    }
+
+    uint32_t difference = LazyConditionCode(sim.codes).bits();
+    sim.predecoded = false;
+    const bool halted =
+        entry(sim.CON.data(), sim.CON.dirty_lines(), &sim.R, &sim.PC,
+              &difference, &Simulator::input, &Simulator::output) != 0;
+
+    sim.codes = LazyConditionCode(difference).materialise();
+    sim.is_halted = halted;
+    return halted;
+  }
+
+  // The default cache location, following the XDG base directory spec.
+  static std::filesystem::path default_cache_directory() {
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+      return std::filesystem::path(xdg) / "mnemonic";
+    }
+    if (const char *home = std::getenv("HOME"); home && *home) {
+      return std::filesystem::path(home) / ".cache" / "mnemonic";
+    }
+    return std::filesystem::temp_directory_path() / "mnemonic";
+  }
+
+private:
+  using Entry = int (*)(uint16_t *, uint8_t *, uint16_t *, uint16_t *,
+                        uint32_t *, int16_t (*)(), void (*)(uint16_t));
+
+  // Bumped whenever the generated code changes, so that stale objects in
+  // the cache are never picked up.
+  static constexpr const char *TRANSLATOR_VERSION = "si-aot-2";
+
+  Simulator &sim;
+  std::filesystem::path cache;
+  void *library{nullptr};
+
+  static uint64_t hash(const std::vector<uint16_t> &image) {
+    uint64_t value = 0xCBF29CE484222325ULL;
+    const auto mix = [&value](uint8_t byte) {
+      value ^= byte;
+      value *= 0x100000001B3ULL;
+    };
+
+    for (const char *c = TRANSLATOR_VERSION; *c != '\0'; ++c) {
+      mix(static_cast<uint8_t>(*c));
+    }
+    for (const auto word : image) {
+      mix(static_cast<uint8_t>(word >> 8));
+      mix(static_cast<uint8_t>(word & 0xFF));
+    }
+    return value;
+  }
+
+  // The addresses control can reach from 0 without leaving the image, or
+  // nothing if one of them writes into another.
+  static std::vector<bool> reachable(const std::vector<uint16_t> &image) {
+    const std::size_t size = image.size();
+    std::vector<bool> seen(size);
+    std::vector<std::size_t> work;
+
+    const auto visit = [&](std::size_t address) {
+      if (address < size && !seen[address]) {
+        seen[address] = true;
+        work.push_back(address);
+      }
+    };
+
+    visit(0);
+    while (!work.empty()) {
+      const std::size_t address = work.back();
+      work.pop_back();
+
+      const MicroOp op{image[address]};
+      switch (op.opcode << 12) {
+      case Simulator::JUMP:
+        visit(op.operand);
+        break;
+      case Simulator::JGT:
+      case Simulator::JEQ:
+      case Simulator::JLT:
+      case Simulator::JNEQ:
+        visit(op.operand);
+        visit(address + 1);
+        break;
+      case Simulator::HALT:
+        break;
+      default:
+        visit(address + 1);
+        break;
+      }
+    }
+
+    for (std::size_t address = 0; address < size; ++address) {
+      if (!seen[address]) {
+        continue;
+      }
+
+      const MicroOp op{image[address]};
+      switch (op.opcode << 12) {
+      case Simulator::STORE:
+      case Simulator::CLEAR:
+      case Simulator::INC:
+      case Simulator::DEC:
+      case Simulator::IN:
+        if (op.operand < size && seen[op.operand]) {
+          return {};
+        }
+        break;
+      }
+    }
+
+    return seen;
+  }
+
+  static std::string translate(const std::vector<uint16_t> &image,
+                               const std::vector<bool> &code) {
+    const std::size_t size = image.size();
+    std::ostringstream c;
+
+    const auto label = [](std::size_t address) {
+      char name[24];
+      std::snprintf(name, sizeof(name), "L%04zX", address);
+      return std::string(name);
+    };
+    const auto go = [&](std::size_t address) {
+      if (address < size && code[address]) {
+        return "goto " + label(address) + ";";
+      }
+      return "{ pc = " + std::to_string(address) + "; goto leave; }";
+    };
+
+    c << "#include <stdint.h>\n\n"
+         "int si_run(uint16_t *M, uint8_t *W, uint16_t *R, uint16_t *PC,\n"
+         "           uint32_t *D, int16_t (*input)(void),\n"
+         "           void (*output)(uint16_t)) {\n"
+         "  static void *const entry[" << size << "] = {\n";
+    for (std::size_t address = 0; address < size; ++address) {
+      if (code[address]) {
+        c << "    [" << address << "] = &&" << label(address) << ",\n";
+      }
+    }
+    c << "  };\n"
+         "  uint16_t r = *R;\n"
+         "  uint32_t d = *D;\n"
+         "  uint16_t pc = *PC;\n"
+         "  int halted = 0;\n"
+         "  if (pc >= " << size << " || !entry[pc]) goto leave;\n"
+         "  goto *entry[pc];\n";
+
+    for (std::size_t address = 0; address < size; ++address) {
+      if (!code[address]) {
+        continue;
+      }
+
+      const MicroOp op{image[address]};
+      const std::string X =
+          "M[" + std::to_string(Memory::index(op.operand)) + "]";
+      // Marks the line X is in as written.
+      const std::string dirty =
+          " W[" + std::to_string(Memory::dirty_byte(op.operand)) +
+          "] |= " + std::to_string(Memory::dirty_bit(op.operand)) + ";";
+      c << label(address) << ": ";
+
+      switch (op.opcode << 12) {
+      case Simulator::LOAD:
+        c << "r = " << X << ";";
+        break;
+      case Simulator::STORE:
+        c << X << " = r;" << dirty;
+        break;
+      case Simulator::CLEAR:
+        c << X << " = 0;" << dirty;
+        break;
+      case Simulator::ADD:
+        c << "r += " << X << ";";
+        break;
+      case Simulator::INC:
+        c << X << "++;" << dirty;
+        break;
+      case Simulator::SUB:
+        c << "r -= " << X << ";";
+        break;
+      case Simulator::DEC:
+        c << X << "--;" << dirty;
+        break;
+      case Simulator::COMP:
+        c << "d = (uint32_t)" << X << " - (uint32_t)r;";
+        break;
+      case Simulator::JUMP:
+        c << go(op.operand);
+        break;
+      case Simulator::JGT:
+        c << "if (d - 1u < 0xFFFFu) " << go(op.operand);
+        break;
+      case Simulator::JEQ:
+        c << "if (d == 0u) " << go(op.operand);
+        break;
+      case Simulator::JLT:
+        c << "if (d + 0xFFFFu < 0xFFFFu) " << go(op.operand);
+        break;
+      case Simulator::JNEQ:
+        c << "if (d != 0u) " << go(op.operand);
+        break;
+      case Simulator::IN:
+        c << X << " = (uint16_t)input();" << dirty;
+        break;
+      case Simulator::OUT:
+        c << "output(" << X << ");";
+        break;
+      case Simulator::HALT:
+        c << "{ pc = " << (address + 1) << "; halted = 1; goto leave; }";
+        break;
+      }
+      c << '\n';
+
+      // Falling off the end of translated code hands back to the caller.
+      if ((op.opcode << 12) != Simulator::JUMP &&
+          (op.opcode << 12) != Simulator::HALT &&
+          (address + 1 >= size || !code[address + 1])) {
+        c << "  " << go(address + 1) << '\n';
+      }
+    }
+
+    c << "leave:\n"
+         "  *R = r;\n"
+         "  *D = d;\n"
+         "  *PC = pc;\n"
+         "  return halted;\n"
+         "}\n";
+
+    return c.str();
+  }
+
+  // Runs the program arguments[0], found on the PATH, with arguments, and
+  // returns whether it exited successfully.
+  static bool execute(const std::vector<std::string> &arguments) {
+    std::vector<char *> argv;
+    for (const auto &argument : arguments) {
+      argv.push_back(const_cast<char *>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    const pid_t child = fork();
+    if (child < 0) {
+      return false;
+    }
+    if (child == 0) {
+      execvp(argv[0], argv.data());
+      _exit(127);
+    }
+
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0) {
+      if (errno != EINTR) {
+        return false;
+      }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+
+  // Compiles source into object, going through a uniquely named temporary
+  // so that concurrent runs never see a partially written object.
+  static bool compile(const std::string &source,
+                      const std::filesystem::path &object) {
+    const std::string unique = "." + std::to_string(getpid()) + ".tmp";
+    const auto source_file = object.string() + unique + ".c";
+    const auto temporary = object.string() + unique;
+
+    std::ofstream(source_file) << source;
+
+    // CC can name the compiler with options of its own, split at spaces as
+    // make would, but nothing else goes through a shell.
+    std::vector<std::string> arguments;
+    const char *compiler = std::getenv("CC");
+    std::istringstream words(compiler != nullptr ? compiler : "");
+    for (std::string word; words >> word;) {
+      arguments.push_back(word);
+    }
+    if (arguments.empty()) {
+      arguments.emplace_back("cc");
+    }
+    for (const char *option : {"-O2", "-shared", "-fPIC", "-w", "-o"}) {
+      arguments.emplace_back(option);
+    }
+    arguments.push_back(temporary);
+    arguments.push_back(source_file);
+
+    const bool compiled = execute(arguments);
+
+    std::error_code error;
+    std::filesystem::remove(source_file, error);
+    if (compiled) {
+      std::filesystem::rename(temporary, object, error);
+    }
+    return compiled && !error;
+  }
+
+  Entry load(const std::vector<uint16_t> &image) {
+    if (image.empty()) {
+      return nullptr;
+    }
+
+    const auto code = reachable(image);
+    if (code.empty()) {
+      std::cerr << "(aot) self-modifying program, interpreting instead\n";
+      return nullptr;
+    }
+
+    char name[20];
+    std::snprintf(name, sizeof(name), "%016llx",
+                  static_cast<unsigned long long>(hash(image)));
+    const auto object = cache / (std::string(name) + ".so");
+
+    std::error_code error;
+    if (!std::filesystem::exists(object, error)) {
+      std::filesystem::create_directories(cache, error);
+      if (!compile(translate(image, code), object)) {
+        std::cerr << "(aot) couldn't compile " << object.string()
+                  << ", interpreting instead\n";
+        return nullptr;
+      }
+    }
+
+    library = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr) {
+      std::cerr << "(aot) " << dlerror() << ", interpreting instead\n";
+      return nullptr;
+    }
+
+    return reinterpret_cast<Entry>(dlsym(library, "si_run"));
+  }
+};
+
+#endif // AOT_HPP
@@ -0,0 +1,79 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "simulator.hpp"
+
+// A checkpoint file holds a Simulator::snapshot() and nothing else. It is
+// written to a temporary file next to the destination, synced, and renamed
+// over it, and then the directory is synced, so neither a process killed
+// part way through nor the machine going down leaves anything but the last
+// checkpoint or the new one.
+inline bool save_checkpoint(const Simulator &sim,
+                            const std::filesystem::path &path) {
+  const auto blob = sim.snapshot();
+  const auto temporary =
+      path.string() + "." + std::to_string(getpid()) + ".tmp";
+
+  const int file =
+      open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file < 0) {
+    return false;
+  }
+  std::size_t written = 0;
+  while (written < blob.size()) {
+    const ssize_t wrote =
+        write(file, blob.data() + written, blob.size() - written);
+    if (wrote < 0 && errno != EINTR) {
+      break;
+    }
+    written += wrote < 0 ? 0 : static_cast<std::size_t>(wrote);
+  }
+  const bool synced = written == blob.size() && fsync(file) == 0;
+  if (close(file) != 0 || !synced) {
+    std::error_code error;
+    std::filesystem::remove(temporary, error);
+    return false;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+  if (error) {
+    std::filesystem::remove(temporary, error);
+    return false;
+  }
+
+  // The rename itself is only durable once the directory is.
+  const auto parent = path.parent_path();
+  const int directory =
+      open(parent.empty() ? "." : parent.c_str(), O_RDONLY | O_DIRECTORY);
+  if (directory < 0) {
+    return false;
+  }
+  const bool durable = fsync(directory) == 0;
+  close(directory);
+  return durable;
+}
+
+inline bool load_checkpoint(Simulator &sim,
+                            const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  const std::vector<uint8_t> blob(std::istreambuf_iterator<char>(file), {});
+  return sim.restore(blob);
+}
+
+#endif // CHECKPOINT_HPP
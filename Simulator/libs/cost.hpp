@@ -0,0 +1,136 @@
+#ifndef COST_HPP
+#define COST_HPP
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "listing.hpp"
+#include "simulator.hpp"
+
+// How many cycles an instruction with each opcode takes. Anything not given
+// a cost takes one.
+struct CostModel {
+  std::array<uint64_t, 16> cycles{1, 1, 1, 1, 1, 1, 1, 1,
+                                   1, 1, 1, 1, 1, 1, 1, 1};
+};
+
+// A cost file has a line for each opcode given a cost: its mnemonic, as in
+// a .lst file, then its cycles, a whole number. Blank lines, and anything
+// after a #, are ignored. For example:
+//
+//   # Memory is slow.
+//   LOAD 4
+//   STORE 4
+//   JUMP 1
+inline bool load_costs(CostModel &model, const std::filesystem::path &path) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  for (std::string line; std::getline(file, line);) {
+    std::istringstream fields(line.substr(0, line.find('#')));
+    std::string name;
+    std::string digits;
+    std::string rest;
+    if (!(fields >> name)) {
+      continue;
+    }
+    if (!(fields >> digits) || fields >> rest) {
+      return false;
+    }
+    // Not with >>, which takes -1 as the largest uint64_t.
+    uint64_t cycles = 0;
+    const auto [end, error] =
+        std::from_chars(digits.data(), digits.data() + digits.size(), cycles);
+    if (error != std::errc() || end != digits.data() + digits.size()) {
+      return false;
+    }
+    int opcode = 0;
+    while (opcode < 16 &&
+           name != Simulator::mnemonic(static_cast<uint16_t>(opcode << 12))) {
+      ++opcode;
+    }
+    if (opcode == 16) {
+      return false;
+    }
+    model.cycles[opcode] = cycles;
+  }
+  return true;
+}
+
+// The cycles a run took, in all and at each address. Like Statistics,
+// they're worked out afterwards from the jumps the simulator counted (see
+// Simulator::count_jumps()), so the engine does nothing more than count
+// once per basic block, and each address is charged for the opcode there
+// when the run stopped.
+struct Cycles {
+  uint64_t total{0};
+  std::vector<uint64_t> at = std::vector<uint64_t>(0x10000);
+
+  template <typename Engine>
+  static Cycles of(const Engine &sim, const CostModel &model) {
+    Cycles run;
+    const auto executions = sim.executions();
+    for (uint32_t at = 0; at < 0x10000; ++at) {
+      if (executions[at] != 0) {
+        const MicroOp op{sim.memory(static_cast<uint16_t>(at))};
+        run.at[at] = executions[at] * model.cycles[op.opcode];
+        run.total += run.at[at];
+      }
+    }
+    return run;
+  }
+};
+
+// Prints the instructions that took the most of a run's cycles, with their
+// source lines, or failing that what's at their addresses now.
+template <typename Engine>
+void report_cycles(const Cycles &run, const Engine &sim, const Listing &listing,
+                   std::ostream &out) {
+  static constexpr std::size_t SHOWN{10};
+
+  std::vector<uint16_t> costly;
+  for (uint32_t at = 0; at < run.at.size(); ++at) {
+    if (run.at[at] != 0) {
+      costly.push_back(static_cast<uint16_t>(at));
+    }
+  }
+  std::stable_sort(costly.begin(), costly.end(),
+                   [&run](uint16_t a, uint16_t b) {
+                     return run.at[a] > run.at[b];
+                   });
+  costly.resize(std::min(costly.size(), SHOWN));
+
+  out << "Costliest instructions (of " << run.total << " cycles)\n";
+  for (const auto at : costly) {
+    std::ostringstream text;
+    text << "  " << std::hex << std::uppercase << std::setfill('0')
+         << std::setw(4) << at << std::dec << std::setfill(' ')
+         << std::setw(14) << run.at[at] << std::setw(8) << std::fixed
+         << std::setprecision(1)
+         << 100.0 * static_cast<double>(run.at[at]) /
+                static_cast<double>(run.total)
+         << "%  ";
+    if (const auto line = listing.lines.find(at);
+        line != listing.lines.end()) {
+      text << "line " << line->second.number << ": " << line->second.text;
+    } else {
+      const uint16_t word = sim.memory(at);
+      text << Simulator::mnemonic(word) << ' ' << std::hex << std::uppercase
+           << static_cast<uint16_t>(MicroOp::decode_operand(word));
+    }
+    out << text.str() << '\n';
+  }
+}
+
+#endif // COST_HPP
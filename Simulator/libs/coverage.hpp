@@ -0,0 +1,235 @@
+#ifndef COVERAGE_HPP
+#define COVERAGE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "listing.hpp"
+#include "simulator.hpp"
+
+// Which addresses a program executed, and which ways its jumps went, as
+// bitmaps with a bit per address. Runs of the same program merge by ORing
+// them together. The program is identified by a hash of its image, so
+// that coverage of one isn't mixed up with another's.
+struct Coverage {
+  uint64_t program{0};
+  std::vector<uint64_t> executed{};
+  std::vector<uint64_t> taken{};
+  std::vector<uint64_t> not_taken{};
+
+  static uint64_t fingerprint(const std::vector<uint16_t> &image) {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (const auto word : image) {
+      hash = (hash ^ word) * 0x100000001B3;
+    }
+    return hash;
+  }
+
+  // From the jumps the simulator counted (see Simulator::count_jumps()).
+  template <typename Engine>
+  static Coverage of(const Engine &sim, const std::vector<uint16_t> &image) {
+    Coverage run;
+    run.program = fingerprint(image);
+    const auto executions = sim.executions();
+    const auto &jumps = sim.jumps_taken();
+
+    // Only as many words as it takes to cover the last address executed.
+    uint32_t end = 0x10000;
+    while (end != 0 && executions[end - 1] == 0) {
+      --end;
+    }
+    run.resize((end + 63) / 64);
+    for (uint32_t at = 0; at < end; ++at) {
+      const uint64_t bit = 1ULL << (at % 64);
+      if (executions[at] != 0) {
+        run.executed[at / 64] |= bit;
+      }
+      if (jumps[at] != 0) {
+        run.taken[at / 64] |= bit;
+      }
+      if (executions[at] > jumps[at]) {
+        run.not_taken[at / 64] |= bit;
+      }
+    }
+    return run;
+  }
+
+  void resize(std::size_t words) {
+    executed.resize(words);
+    taken.resize(words);
+    not_taken.resize(words);
+  }
+
+  void merge(const Coverage &other) {
+    if (other.executed.size() > executed.size()) {
+      resize(other.executed.size());
+    }
+    for (std::size_t i = 0; i < other.executed.size(); ++i) {
+      executed[i] |= other.executed[i];
+      taken[i] |= other.taken[i];
+      not_taken[i] |= other.not_taken[i];
+    }
+  }
+
+  static bool has(const std::vector<uint64_t> &bits, uint16_t at) {
+    return at / 64U < bits.size() && (bits[at / 64U] >> (at % 64U) & 1) != 0;
+  }
+};
+
+// A coverage file is the magic and version, the program's hash, the number
+// of 64-bit words in each bitmap, then the executed, taken and not-taken
+// bitmaps, all little-endian.
+namespace coverage {
+
+constexpr char MAGIC[4] = {'M', 'N', 'C', 'V'};
+constexpr uint16_t VERSION{1};
+constexpr std::size_t HEADER{sizeof(MAGIC) + 2 + 8 + 4};
+
+template <typename T> void put(std::vector<uint8_t> &blob, T value) {
+  for (std::size_t i = 0; i < sizeof(T); i++) {
+    blob.push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+template <typename T> T get(const uint8_t *bytes) {
+  T value = 0;
+  for (std::size_t i = 0; i < sizeof(T); i++) {
+    value |= static_cast<T>(static_cast<T>(bytes[i]) << (8 * i));
+  }
+  return value;
+}
+
+} // namespace coverage
+
+inline bool save_coverage(const Coverage &run,
+                          const std::filesystem::path &path) {
+  std::vector<uint8_t> blob(std::begin(coverage::MAGIC),
+                            std::end(coverage::MAGIC));
+  coverage::put(blob, coverage::VERSION);
+  coverage::put(blob, run.program);
+  coverage::put(blob, static_cast<uint32_t>(run.executed.size()));
+  for (const auto *bits : {&run.executed, &run.taken, &run.not_taken}) {
+    for (const auto word : *bits) {
+      coverage::put(blob, word);
+    }
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(blob.data()),
+             static_cast<std::streamsize>(blob.size()));
+  return static_cast<bool>(file.flush());
+}
+
+// Reads a whole coverage file in one go, since merging thousands of them
+// is mostly reading them.
+inline bool load_coverage(Coverage &run, const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  std::vector<uint8_t> blob(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0);
+  if (!file.read(reinterpret_cast<char *>(blob.data()),
+                 static_cast<std::streamsize>(blob.size())) ||
+      blob.size() < coverage::HEADER ||
+      !std::equal(std::begin(coverage::MAGIC), std::end(coverage::MAGIC),
+                  blob.begin()) ||
+      coverage::get<uint16_t>(&blob[4]) != coverage::VERSION) {
+    return false;
+  }
+
+  run.program = coverage::get<uint64_t>(&blob[6]);
+  const uint32_t words = coverage::get<uint32_t>(&blob[14]);
+  if (words > 0x10000 / 64 || blob.size() != coverage::HEADER + words * 24U) {
+    return false;
+  }
+  run.resize(words);
+  const uint8_t *at = blob.data() + coverage::HEADER;
+  for (auto *bits : {&run.executed, &run.taken, &run.not_taken}) {
+    for (auto &word : *bits) {
+      word = coverage::get<uint64_t>(at);
+      at += 8;
+    }
+  }
+  return true;
+}
+
+// Prints every line of the program's listing marked with whether it ran:
+// ##### if it didn't, - for a directive, and for a jump that only went one
+// way, which way that was. Without a listing, every word of the image is
+// listed as an instruction. Ends with how much of the program was covered.
+inline void report_coverage(const Coverage &run,
+                            const std::vector<uint16_t> &image,
+                            const Listing &listing, std::ostream &out) {
+  Listing lines = listing;
+  if (lines.lines.empty()) {
+    for (std::size_t at = 0; at < image.size(); ++at) {
+      std::ostringstream text;
+      text << std::hex << std::uppercase << std::setfill('0') << std::setw(4)
+           << at << ": " << Simulator::mnemonic(image[at]) << ' '
+           << static_cast<uint16_t>(MicroOp::decode_operand(image[at]));
+      lines.lines[static_cast<uint16_t>(at)] = {at, text.str()};
+    }
+  }
+
+  uint64_t instructions = 0;
+  uint64_t executed = 0;
+  uint64_t directions = 0;
+  uint64_t went = 0;
+  for (const auto &[at, line] : lines.lines) {
+    std::string note;
+    if (line.directive()) {
+      out << "    -";
+    } else {
+      ++instructions;
+      const bool ran = Coverage::has(run.executed, at);
+      executed += ran;
+      out << (ran ? "     " : "#####");
+
+      const uint16_t code = at < image.size() ? image[at] & 0xF000 : 0;
+      if (code == Simulator::JUMP) {
+        ++directions;
+        went += ran;
+      } else if (code >= Simulator::JGT && code <= Simulator::JNEQ) {
+        const bool taken = Coverage::has(run.taken, at);
+        const bool passed = Coverage::has(run.not_taken, at);
+        directions += 2;
+        went += taken + passed;
+        if (taken != passed) {
+          note = taken ? "  (always taken)" : "  (never taken)";
+        }
+      }
+    }
+    out << "  ";
+    if (listing.lines.empty()) {
+      out << line.text;
+    } else {
+      out << "line " << line.number << ": " << line.text;
+    }
+    out << note << '\n';
+  }
+
+  const auto percent = [](uint64_t part, uint64_t whole) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1)
+         << (whole == 0 ? 100.0
+                        : 100.0 * static_cast<double>(part) /
+                              static_cast<double>(whole))
+         << '%';
+    return text.str();
+  };
+  out << executed << " of " << instructions << " instructions run ("
+      << percent(executed, instructions) << "), " << went << " of "
+      << directions << " jump directions taken ("
+      << percent(went, directions) << ")\n";
+}
+
+#endif // COVERAGE_HPP
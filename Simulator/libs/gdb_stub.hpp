@@ -0,0 +1,602 @@
+#ifndef GDB_STUB_HPP
+#define GDB_STUB_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "history.hpp"
+#include "simulator.hpp"
+
+// Serves one debugger over the GDB Remote Serial Protocol. The simulator
+// runs at full speed with the threaded engine between stops. Breakpoints
+// and write watchpoints are the simulator's own traps, and a single step
+// traps wherever the instruction can go next, so the debugger is never
+// consulted per instruction. It can also go backwards (reverse-stepi and
+// reverse-continue, which with a watchpoint goes back to the last write),
+// through a History.
+//
+// Addresses are in bytes, two to a word, with words big-endian as in
+// object files. There are two registers: r (16 bits) and pc (32 bits, as a
+// byte address). Memory outside the simulator's window holds the program
+// image and is read-only.
+class GdbStub {
+public:
+  explicit GdbStub(Simulator &simulator) : sim(simulator), past(simulator) {}
+
+  GdbStub(const GdbStub &) = delete;
+  GdbStub &operator=(const GdbStub &) = delete;
+
+  ~GdbStub() {
+    if (client >= 0) {
+      close(client);
+    }
+    if (listener >= 0) {
+      close(listener);
+    }
+    if (!socket_path.empty()) {
+      unlink(socket_path.c_str());
+    }
+  }
+
+  // Waits for a debugger to connect on where: a port on localhost if it's
+  // a number, and the path of a Unix socket otherwise.
+  bool listen(const std::string &where) {
+    const bool port =
+        !where.empty() && std::all_of(where.begin(), where.end(), [](char c) {
+          return std::isdigit(static_cast<unsigned char>(c)) != 0;
+        });
+
+    if (port) {
+      unsigned number = 0;
+      const auto [end, error] =
+          std::from_chars(where.data(), where.data() + where.size(), number);
+      if (error != std::errc{} || end != where.data() + where.size() ||
+          number < 1 || number > 0xFFFF) {
+        std::cerr << "(gdb) not a port: " << where << '\n';
+        return false;
+      }
+      listener = socket(AF_INET, SOCK_STREAM, 0);
+      if (listener < 0) {
+        return fail("couldn't open a socket");
+      }
+      const int yes = 1;
+      setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+      sockaddr_in address{};
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      address.sin_port = htons(static_cast<uint16_t>(number));
+      if (bind(listener, reinterpret_cast<sockaddr *>(&address),
+               sizeof(address)) != 0) {
+        return fail("couldn't listen on port " + where);
+      }
+    } else {
+      sockaddr_un address{};
+      if (where.size() >= sizeof(address.sun_path)) {
+        return fail("socket path too long: " + where);
+      }
+      listener = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listener < 0) {
+        return fail("couldn't open a socket");
+      }
+      address.sun_family = AF_UNIX;
+      std::strcpy(address.sun_path, where.c_str());
+      unlink(where.c_str());
+      if (bind(listener, reinterpret_cast<sockaddr *>(&address),
+               sizeof(address)) != 0) {
+        return fail("couldn't listen on " + where);
+      }
+      socket_path = where;
+    }
+
+    if (::listen(listener, 1) != 0) {
+      return fail("couldn't listen on " + where);
+    }
+    std::cerr << "(gdb) waiting for a debugger on " << where << '\n';
+    client = accept(listener, nullptr, nullptr);
+    if (client < 0) {
+      return fail("couldn't accept a debugger");
+    }
+    if (port) {
+      const int yes = 1;
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    return true;
+  }
+
+  // Answers the debugger until it detaches or kills the program, or goes
+  // away. Returns whether the program should carry on running without it.
+  bool serve() {
+    std::string stop = "S05";
+    while (const auto packet = receive()) {
+      const std::string &p = *packet;
+      const char command = p.empty() ? '\0' : p[0];
+
+      if (command == '?') {
+        send(stop);
+      } else if (command == 'c' || command == 'C' || command == 's' ||
+                 command == 'S') {
+        // c and s may give an address to carry on from; C and S a signal
+        // (ignored) and then maybe an address.
+        const auto at = command == 'c' || command == 's' ? 0 : p.find(';');
+        if (at != std::string::npos && at + 1 < p.size()) {
+          sim.set_program_counter(
+              static_cast<uint16_t>(hex(p.substr(at + 1)) / 2));
+          past.changed();
+        }
+        stop = command == 'c' || command == 'C' ? carry_on() : step();
+        send(stop);
+        if (sim.halted()) {
+          return false;
+        }
+      } else if (p == "bs" || p == "bc") {
+        stop = go_back(p == "bc");
+        send(stop);
+      } else if (command == 'g') {
+        send(registers());
+      } else if (command == 'G') {
+        if (p.size() >= 13) {
+          sim.set_accumulator(static_cast<uint16_t>(hex(p.substr(1, 4))));
+          sim.set_program_counter(
+              static_cast<uint16_t>(hex(p.substr(5, 8)) / 2));
+          past.changed();
+        }
+        send("OK");
+      } else if (command == 'p') {
+        const auto n = hex(p.substr(1));
+        send(n == 0 ? registers().substr(0, 4)
+                    : n == 1 ? registers().substr(4) : "E01");
+      } else if (command == 'P') {
+        const auto equals = p.find('=');
+        const auto n = hex(p.substr(1, equals - 1));
+        const auto value = hex(p.substr(equals + 1));
+        if (n == 0) {
+          sim.set_accumulator(static_cast<uint16_t>(value));
+        } else if (n == 1) {
+          sim.set_program_counter(static_cast<uint16_t>(value / 2));
+        }
+        if (n <= 1) {
+          past.changed();
+        }
+        send(n <= 1 ? "OK" : "E01");
+      } else if (command == 'm') {
+        send(read_memory(p));
+      } else if (command == 'M' || command == 'X') {
+        send(write_memory(p));
+      } else if (command == 'Z' || command == 'z') {
+        send(point(p));
+      } else if (command == 'D') {
+        send("OK");
+        return true;
+      } else if (command == 'k') {
+        return false;
+      } else if (p == "vKill" || p.rfind("vKill;", 0) == 0) {
+        send("OK");
+        return false;
+      } else if (command == 'H' || command == 'T') {
+        send("OK");
+      } else if (p.rfind("qSupported", 0) == 0) {
+        send("PacketSize=" + to_hex(PACKET_SIZE, 0) +
+             ";QStartNoAckMode+;qXfer:features:read+;swbreak+;"
+             "ReverseStep+;ReverseContinue+");
+      } else if (p == "QStartNoAckMode") {
+        send("OK");
+        acknowledging = false;
+      } else if (p.rfind("qXfer:features:read:target.xml:", 0) == 0) {
+        send(features(p));
+      } else if (p == "qAttached") {
+        send("1");
+      } else if (p == "qC") {
+        send("QC1");
+      } else if (p == "qfThreadInfo") {
+        send("m1");
+      } else if (p == "qsThreadInfo") {
+        send("l");
+      } else {
+        send("");
+      }
+    }
+    return false;
+  }
+
+private:
+  // The most a packet can hold, so that a debugger reads memory in as few
+  // round trips as possible.
+  static constexpr std::size_t PACKET_SIZE{0x4000};
+  // How many instructions to run between checks for an interrupt from the
+  // debugger.
+  static constexpr uint64_t SLICE{1 << 24};
+
+  static constexpr const char *TARGET_XML =
+      "<?xml version=\"1.0\"?>"
+      "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+      "<target version=\"1.0\">"
+      "<feature name=\"org.mnemonic.core\">"
+      "<reg name=\"r\" bitsize=\"16\" type=\"int16\" regnum=\"0\"/>"
+      "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\" regnum=\"1\"/>"
+      "</feature>"
+      "</target>";
+
+  Simulator &sim;
+  History past;
+  int listener{-1};
+  int client{-1};
+  std::string socket_path{};
+  std::string inbox{};
+  std::string last_sent{};
+  bool acknowledging{true};
+  bool interrupted{false};
+  // The debugger's breakpoints, so that step() leaves them alone.
+  std::set<uint16_t> breakpoints{};
+
+  bool fail(const std::string &message) {
+    std::cerr << "(gdb) " << message << ": " << std::strerror(errno) << '\n';
+    return false;
+  }
+
+  static uint64_t hex(const std::string &text) {
+    uint64_t value = 0;
+    for (const char c : text) {
+      if (!std::isxdigit(static_cast<unsigned char>(c))) {
+        break;
+      }
+      value = value << 4 | static_cast<uint64_t>(
+                               std::isdigit(static_cast<unsigned char>(c))
+                                   ? c - '0'
+                                   : std::tolower(c) - 'a' + 10);
+    }
+    return value;
+  }
+
+  // value as digits hex digits, or as few as it needs if digits is 0.
+  static std::string to_hex(uint64_t value, int digits) {
+    char text[20];
+    std::snprintf(text, sizeof(text), "%0*llx", digits,
+                  static_cast<unsigned long long>(value));
+    return text;
+  }
+
+  // Takes whatever the debugger has sent, waiting for it if block is set.
+  // Returns false once the debugger has gone.
+  bool fill(bool block) {
+    pollfd ready{client, POLLIN, 0};
+    if (!block && poll(&ready, 1, 0) <= 0) {
+      return true;
+    }
+    char buffer[PACKET_SIZE];
+    const auto got = recv(client, buffer, sizeof(buffer), 0);
+    if (got <= 0) {
+      return false;
+    }
+    for (ssize_t i = 0; i < got; ++i) {
+      // An interrupt comes outside of any packet.
+      if (buffer[i] == '\x03' && inbox.find('$') == std::string::npos) {
+        interrupted = true;
+      } else {
+        inbox.push_back(buffer[i]);
+      }
+    }
+    return true;
+  }
+
+  // The next packet's contents, unescaped, or nothing once the debugger
+  // has gone.
+  std::optional<std::string> receive() {
+    for (;;) {
+      // Whatever comes before a packet is acknowledgements, and a '-' asks
+      // for the last packet again.
+      const auto start = inbox.find('$');
+      if (inbox.substr(0, start).find('-') != std::string::npos) {
+        write_all(last_sent);
+      }
+      inbox.erase(0, start == std::string::npos ? inbox.size() : start);
+
+      // Finds the end of the packet, skipping escaped characters.
+      std::size_t end = std::string::npos;
+      for (std::size_t i = 1; i < inbox.size(); ++i) {
+        if (inbox[i] == '}') {
+          ++i;
+        } else if (inbox[i] == '#') {
+          end = i;
+          break;
+        }
+      }
+
+      if (end != std::string::npos && end + 3 <= inbox.size()) {
+        const std::string body = inbox.substr(1, end - 1);
+        const auto sum = hex(inbox.substr(end + 1, 2));
+        inbox.erase(0, end + 3);
+
+        uint8_t expected = 0;
+        for (const char c : body) {
+          expected = static_cast<uint8_t>(expected + c);
+        }
+        if (acknowledging) {
+          write_all(expected == sum ? "+" : "-");
+          if (expected != sum) {
+            continue;
+          }
+        }
+
+        std::string packet;
+        for (std::size_t i = 0; i < body.size(); ++i) {
+          packet.push_back(body[i] == '}' && i + 1 < body.size()
+                               ? static_cast<char>(body[++i] ^ 0x20)
+                               : body[i]);
+        }
+        return packet;
+      }
+
+      if (!fill(true)) {
+        return std::nullopt;
+      }
+    }
+  }
+
+  void write_all(const std::string &data) {
+    for (std::size_t sent = 0; sent < data.size();) {
+      const auto wrote =
+          ::send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (wrote <= 0) {
+        return;
+      }
+      sent += static_cast<std::size_t>(wrote);
+    }
+  }
+
+  void send(const std::string &payload) {
+    uint8_t sum = 0;
+    std::string packet = "$";
+    for (const char c : payload) {
+      if (c == '$' || c == '#' || c == '}' || c == '*') {
+        packet.push_back('}');
+        packet.push_back(static_cast<char>(c ^ 0x20));
+        sum = static_cast<uint8_t>(sum + '}' + (c ^ 0x20));
+      } else {
+        packet.push_back(c);
+        sum = static_cast<uint8_t>(sum + c);
+      }
+    }
+    packet += "#" + to_hex(sum, 2);
+    last_sent = packet;
+    write_all(packet);
+  }
+
+  std::string registers() const {
+    return to_hex(sim.accumulator(), 4) +
+           to_hex(uint64_t{sim.program_counter()} * 2, 8);
+  }
+
+  // The reply to a stop by run_threaded() or step().
+  std::string stopped() {
+    if (sim.halted()) {
+      return "W00";
+    }
+    if (const auto &hit = sim.hit()) {
+      if (hit->kind == Simulator::Hit::BREAKPOINT) {
+        return "T05swbreak:;";
+      }
+      // A watchpoint stops before the write, and debuggers expect to see
+      // it done.
+      const auto word = hit->address;
+      step();
+      if (sim.halted()) {
+        return "W00";
+      }
+      return "T05watch:" + to_hex(uint64_t{word} * 2, 0) + ";";
+    }
+    if (sim.out_of_budget() || sim.out_of_time()) {
+      return "S18";
+    }
+    return "S05";
+  }
+
+  std::string carry_on() {
+    interrupted = false;
+    for (;;) {
+      sim.pause_after(sim.instructions() + SLICE);
+      past.run_threaded();
+      sim.pause_after(std::numeric_limits<uint64_t>::max());
+
+      if (sim.halted() || sim.hit() || sim.infinite_loop() ||
+          sim.out_of_budget() || sim.out_of_time() ||
+          sim.waiting_for_input()) {
+        return stopped();
+      }
+      if (!fill(false)) {
+        return "S05";
+      }
+      if (interrupted) {
+        return "S02";
+      }
+    }
+  }
+
+  // Runs the one instruction at PC, with breakpoints wherever it can go
+  // next.
+  std::string step() {
+    const uint16_t at = sim.program_counter();
+    const MicroOp op{sim.memory(at)};
+
+    std::vector<uint16_t> next{static_cast<uint16_t>(at + 1)};
+    switch (op.opcode << 12) {
+    case Simulator::JUMP:
+      next[0] = op.operand;
+      break;
+    case Simulator::JGT:
+    case Simulator::JEQ:
+    case Simulator::JLT:
+    case Simulator::JNEQ:
+      next.push_back(op.operand);
+      break;
+    }
+
+    std::vector<uint16_t> added;
+    for (const auto address : next) {
+      if (breakpoints.count(address) == 0) {
+        sim.set_breakpoint(address);
+        added.push_back(address);
+      }
+    }
+
+    // A trap at PC itself only lets run_threaded() by once it has stopped
+    // there.
+    const uint64_t before = sim.instructions();
+    past.run_threaded();
+    if (sim.hit() && sim.program_counter() == at &&
+        sim.instructions() == before) {
+      past.run_threaded();
+    }
+
+    for (const auto address : added) {
+      sim.clear_breakpoint(address);
+    }
+    if (sim.halted() || sim.infinite_loop() || sim.out_of_budget() ||
+        sim.out_of_time()) {
+      return stopped();
+    }
+    return "S05";
+  }
+
+  // The reply to bs or bc. Going back stops before the instruction at a
+  // breakpoint or which writes a watched word, as going forward does, and
+  // watched writes are left undone.
+  std::string go_back(bool continuing) {
+    if (!continuing) {
+      return past.step_back() ? "S05" : "T05replaylog:begin;";
+    }
+    const auto hit = past.reverse_continue();
+    if (!hit) {
+      return "T05replaylog:begin;";
+    }
+    if (hit->kind == Simulator::Hit::BREAKPOINT) {
+      return "T05swbreak:;";
+    }
+    return "T05watch:" + to_hex(uint64_t{hit->address} * 2, 0) + ";";
+  }
+
+  std::string read_memory(const std::string &p) const {
+    const auto comma = p.find(',');
+    uint64_t address = hex(p.substr(1, comma - 1));
+    const uint64_t length =
+        std::min<uint64_t>(hex(p.substr(comma + 1)), PACKET_SIZE / 2 - 8);
+
+    std::string data;
+    data.reserve(length * 2);
+    for (uint64_t i = 0; i < length && address < 0x20000; ++i, ++address) {
+      const uint16_t word = sim.memory(static_cast<uint16_t>(address / 2));
+      data += to_hex(address % 2 == 0 ? word >> 8 : word & 0xFF, 2);
+    }
+    return data.empty() && length != 0 ? "E01" : data;
+  }
+
+  // M sends the bytes in hex, X as they are.
+  std::string write_memory(const std::string &p) {
+    const auto comma = p.find(',');
+    const auto colon = p.find(':');
+    if (comma == std::string::npos || colon == std::string::npos) {
+      return "E01";
+    }
+    const uint64_t start = hex(p.substr(1, comma - 1));
+    const uint64_t length = hex(p.substr(comma + 1, colon - comma - 1));
+    if (p.size() - colon - 1 != (p[0] == 'X' ? length : length * 2)) {
+      return "E01";
+    }
+
+    std::vector<uint8_t> bytes;
+    for (uint64_t i = 0; i < length; ++i) {
+      bytes.push_back(static_cast<uint8_t>(
+          p[0] == 'X' ? p[colon + 1 + i] : hex(p.substr(colon + 1 + i * 2, 2))));
+    }
+
+    // History only needs telling once, however many words changed.
+    uint64_t address = start;
+    bool wrote = false;
+    for (const auto byte : bytes) {
+      const auto word = static_cast<uint16_t>(address / 2);
+      const uint16_t old = sim.memory(word);
+      const uint16_t value =
+          address % 2 == 0 ? static_cast<uint16_t>(byte << 8 | (old & 0xFF))
+                           : static_cast<uint16_t>((old & 0xFF00) | byte);
+      if (address >= 0x20000 ||
+          (value != old && !sim.set_memory(word, value))) {
+        break;
+      }
+      wrote = wrote || value != old;
+      ++address;
+    }
+    if (wrote) {
+      past.changed();
+    }
+    return address == start + length ? "OK" : "E01";
+  }
+
+  // Z0 and Z1 set breakpoints, Z2 a write watchpoint; z removes them.
+  std::string point(const std::string &p) {
+    const bool insert = p[0] == 'Z';
+    const char type = p.size() > 1 ? p[1] : '\0';
+    const auto first = p.find(',');
+    const auto second = p.find(',', first + 1);
+    if (first == std::string::npos || second == std::string::npos) {
+      return "E01";
+    }
+    const uint64_t address = hex(p.substr(first + 1, second - first - 1));
+    const uint64_t length = hex(p.substr(second + 1));
+
+    if (type == '0' || type == '1') {
+      const auto word = static_cast<uint16_t>(address / 2);
+      if (insert) {
+        breakpoints.insert(word);
+        sim.set_breakpoint(word);
+      } else {
+        breakpoints.erase(word);
+        sim.clear_breakpoint(word);
+      }
+      return "OK";
+    }
+    if (type == '2') {
+      for (uint64_t byte = address & ~uint64_t{1};
+           byte < address + std::max<uint64_t>(length, 1); byte += 2) {
+        if (insert) {
+          sim.watch(static_cast<uint16_t>(byte / 2));
+        } else {
+          sim.unwatch(static_cast<uint16_t>(byte / 2));
+        }
+      }
+      return "OK";
+    }
+    return "";
+  }
+
+  static std::string features(const std::string &p) {
+    const auto at = p.rfind(':');
+    const auto comma = p.find(',', at);
+    const std::string xml = TARGET_XML;
+    const auto offset = hex(p.substr(at + 1, comma - at - 1));
+    const auto length = hex(p.substr(comma + 1));
+    if (offset >= xml.size()) {
+      return "l";
+    }
+    const auto chunk = xml.substr(offset, length);
+    return (offset + chunk.size() < xml.size() ? "m" : "l") + chunk;
+  }
+};
+
+#endif // GDB_STUB_HPP
@@ -0,0 +1,302 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "simulator.hpp"
+
+// Takes a simulator back through what it has executed: one instruction at
+// a time, or until it's back at a breakpoint or about to write a watched
+// word (so, with one word watched, back to its last write).
+//
+// Going forward, run_threaded() saves a snapshot every so often: the
+// registers, the instruction count, how far the program had got with its
+// I/O, and a copy of memory, which is only as big as the chunks the
+// simulator has written. To go back, the simulator is put back to the last
+// snapshot before where it is and stepped forward again to there, logging
+// how to undo each instruction: the registers as they were and the one
+// word it overwrote. From then on each step back just undoes the next
+// entry. Input is read again from the simulator's journal on the way, and
+// output isn't written twice, so the program goes the same way every time.
+//
+// Memory use is bounded. Past MAX_SNAPSHOTS every other snapshot is
+// dropped and they're saved half as often, and the undo log only covers
+// the last MAX_UNDO instructions of the stretch it was built for.
+class History {
+public:
+  explicit History(Simulator &simulator) : sim(simulator) {
+    sim.journaling = true;
+    sim.shown = sim.written;
+    save();
+  }
+
+  History(const History &) = delete;
+  History &operator=(const History &) = delete;
+
+  // Runs the threaded engine as Simulator::run_threaded() does, saving
+  // snapshots on the way.
+  void run_threaded() {
+    const uint64_t until = sim.pause;
+    for (;;) {
+      const uint64_t next = snapshots.back().executed + interval;
+      sim.pause_after(std::min(until, next));
+      sim.run_threaded();
+      if (sim.executed >= next) {
+        save();
+      }
+      if (sim.executed >= until || sim.halted() || sim.hit() || sim.stuck ||
+          sim.exhausted() || sim.waiting_for_input()) {
+        break;
+      }
+    }
+    sim.pause_after(until);
+  }
+
+  // Undoes the last instruction executed. Returns false, having done
+  // nothing, at the start of history.
+  bool step_back() {
+    if (log.empty() || sim.executed != logged) {
+      const Snapshot *from = before(sim.executed);
+      if (from == nullptr) {
+        return false;
+      }
+      replay(*from, sim.executed);
+    }
+    undo();
+    return true;
+  }
+
+  // Goes back to the last time the simulator was at a breakpoint, or about
+  // to write a watched word, and returns which; or if there isn't one, to
+  // the start of history.
+  std::optional<Simulator::Hit> reverse_continue() {
+    if (sim.executed != logged) {
+      log.clear();
+    }
+    while (!log.empty()) {
+      undo();
+      if (const auto hit = trap()) {
+        return hit;
+      }
+    }
+
+    // Then a stretch between snapshots at a time, finding the last stop in
+    // it going forward before going back there.
+    for (;;) {
+      const uint64_t now = sim.executed;
+      const Snapshot *from = before(now);
+      if (from == nullptr) {
+        return std::nullopt;
+      }
+      restore(*from);
+
+      uint64_t last = NOWHERE;
+      while (sim.executed < now) {
+        if (trap()) {
+          last = sim.executed;
+        }
+        if (!advance()) {
+          break;
+        }
+      }
+
+      if (last != NOWHERE) {
+        replay(*from, last);
+        return trap();
+      }
+      restore(*from);
+    }
+  }
+
+  // To be called once the simulator's registers or memory have been
+  // changed other than by running it. Everything after this point on the
+  // old timeline is forgotten, including input read there, which will be
+  // asked for again.
+  void changed() {
+    while (!snapshots.empty() && snapshots.back().executed >= sim.executed) {
+      snapshots.pop_back();
+    }
+    sim.journal.resize(sim.replayed);
+    sim.shown = sim.written;
+    log.clear();
+    save();
+  }
+
+private:
+  // Kept even, so that thinning keeps the newest snapshot as well as the
+  // oldest.
+  static constexpr std::size_t MAX_SNAPSHOTS{1024};
+  static constexpr uint64_t MAX_UNDO{1 << 16};
+  static constexpr uint64_t NOWHERE{std::numeric_limits<uint64_t>::max()};
+
+  struct Snapshot {
+    uint64_t executed;
+    Memory memory;
+    uint16_t R;
+    uint16_t PC;
+    ConditionCode codes;
+    bool halted;
+    std::size_t inputs;
+    uint64_t outputs;
+  };
+
+  // How to undo one instruction: the registers from before it, and the
+  // word it overwrote (if WROTE is set) with what was there.
+  enum : uint8_t {
+    GT = 1,
+    EQ = 2,
+    LT = 4,
+    WROTE = 8,
+    READ = 16,
+    WRITTEN = 32,
+  };
+  struct Undo {
+    uint16_t PC;
+    uint16_t R;
+    uint16_t address;
+    uint16_t word;
+    uint8_t flags;
+  };
+
+  Simulator &sim;
+  std::vector<Snapshot> snapshots{};
+  uint64_t interval{MAX_UNDO};
+  std::vector<Undo> log{};
+  // The instruction count the log ends at.
+  uint64_t logged{NOWHERE};
+
+  void save() {
+    snapshots.push_back({sim.executed, sim.CON, sim.R, sim.PC, sim.codes,
+                         sim.is_halted, sim.replayed, sim.written});
+    if (snapshots.size() > MAX_SNAPSHOTS) {
+      std::size_t kept = 0;
+      for (std::size_t i = 0; i < snapshots.size(); i += 2) {
+        snapshots[kept++] = std::move(snapshots[i]);
+      }
+      snapshots.resize(kept);
+      interval *= 2;
+    }
+  }
+
+  // The last snapshot from before the instruction count, if any.
+  const Snapshot *before(uint64_t executed) const {
+    const auto after = std::lower_bound(
+        snapshots.begin(), snapshots.end(), executed,
+        [](const Snapshot &snapshot, uint64_t count) {
+          return snapshot.executed < count;
+        });
+    return after == snapshots.begin() ? nullptr : &*std::prev(after);
+  }
+
+  // Lets the simulator run on from wherever it has been put, as if it had
+  // got there by itself. Going forward it executes the instruction it's at
+  // even if there's a breakpoint there.
+  void settle() {
+    sim.spent = false;
+    sim.late = false;
+    sim.schedule();
+    sim.forget_states();
+    sim.stuck.reset();
+    sim.trapped.reset();
+    sim.resuming = sim.PC;
+  }
+
+  void restore(const Snapshot &snapshot) {
+    sim.replace_memory(snapshot.memory);
+    sim.executed = snapshot.executed;
+    sim.R = snapshot.R;
+    sim.PC = snapshot.PC;
+    sim.codes = snapshot.codes;
+    sim.is_halted = snapshot.halted;
+    sim.replayed = snapshot.inputs;
+    sim.written = snapshot.outputs;
+    settle();
+  }
+
+  // Executes one instruction, returning false if it couldn't.
+  bool advance() {
+    const uint64_t before = sim.executed;
+    sim.step();
+    return sim.executed != before;
+  }
+
+  // Puts the simulator back to from and steps it forward to the instruction
+  // count to, logging the way back from there.
+  void replay(const Snapshot &from, uint64_t to) {
+    restore(from);
+    log.clear();
+    while (sim.executed < to) {
+      if (to - sim.executed > MAX_UNDO) {
+        if (!advance()) {
+          break;
+        }
+        continue;
+      }
+
+      Undo entry{sim.PC, sim.R, 0, 0,
+                 static_cast<uint8_t>(sim.codes.GT * GT | sim.codes.EQ * EQ |
+                                      sim.codes.LT * LT)};
+      const uint16_t instruction = sim.CON.fetch(sim.PC);
+      switch (instruction & 0xF000) {
+      case Simulator::IN:
+        entry.flags |= READ;
+        [[fallthrough]];
+      case Simulator::STORE:
+      case Simulator::CLEAR:
+      case Simulator::INC:
+      case Simulator::DEC:
+        entry.address = MicroOp::decode_operand(instruction);
+        entry.word = sim.CON(entry.address);
+        entry.flags |= WROTE;
+        break;
+      case Simulator::OUT:
+        entry.flags |= WRITTEN;
+        break;
+      }
+
+      if (!advance()) {
+        break;
+      }
+      log.push_back(entry);
+    }
+    logged = sim.executed;
+  }
+
+  void undo() {
+    const Undo entry = log.back();
+    log.pop_back();
+    if ((entry.flags & WROTE) != 0) {
+      sim.set_memory(entry.address, entry.word);
+    }
+    sim.R = entry.R;
+    sim.PC = entry.PC;
+    sim.codes = ConditionCode((entry.flags & GT) != 0, (entry.flags & EQ) != 0,
+                              (entry.flags & LT) != 0);
+    sim.is_halted = false;
+    --sim.executed;
+    sim.replayed -= (entry.flags & READ) != 0;
+    sim.written -= (entry.flags & WRITTEN) != 0;
+    --logged;
+    settle();
+  }
+
+  // Why the threaded engine would stop before the instruction at PC.
+  std::optional<Simulator::Hit> trap() const {
+    const uint16_t at = sim.PC;
+    const uint16_t instruction = sim.CON.fetch(at);
+    if (!sim.traps(at, instruction)) {
+      return std::nullopt;
+    }
+    if (sim.breakpoints.count(at) != 0) {
+      return Simulator::Hit{Simulator::Hit::BREAKPOINT, at};
+    }
+    return Simulator::Hit{Simulator::Hit::WATCHPOINT,
+                          MicroOp::decode_operand(instruction)};
+  }
+};
+
+#endif // HISTORY_HPP
@@ -0,0 +1,496 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define SIMULATOR_HAS_JIT 1
+#endif
+
+#include "simulator.hpp"
+
+// Translates basic blocks of the loaded program into x86-64 code and runs
+// them natively. A block ends at the first JUMP, JUMPxx, IN, OUT or HALT.
+// Jumps and conditional jumps chain straight into the target block once it
+// has been translated; IN, OUT and HALT leave the generated code and are
+// carried out here. While inside generated code the accumulator lives in
+// ebx, the (lazy) condition codes in r12d and the dirty line map in r11.
+// Each way out of a block first adds the instructions it ran to the count
+// in State, which the block knows when it's translated.
+//
+// Every translated word is marked in a byte map, and each write made by
+// generated code checks that map. A write into translated code leaves the
+// block straight after the write and flushes the whole code cache, so the
+// new instructions are picked up when they are next reached.
+//
+// The code cache is never writable and executable at once. It's mapped
+// writable, made executable (and read-only) before generated code runs,
+// and made writable again only to translate a block or link a jump.
+class Jit {
+public:
+  explicit Jit(Simulator &simulator) : sim(simulator) {
+#if defined(SIMULATOR_HAS_JIT)
+    void *mapping = mmap(nullptr, CACHE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping != MAP_FAILED) {
+      code = static_cast<uint8_t *>(mapping);
+      emit_trampolines();
+      // Where the system won't make mapped memory executable, there's
+      // nothing to run the code in.
+      if (!protect(false)) {
+        munmap(code, CACHE_SIZE);
+        code = nullptr;
+      }
+    }
+#endif
+  }
+
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  ~Jit() {
+#if defined(SIMULATOR_HAS_JIT)
+    if (code != nullptr) {
+      munmap(code, CACHE_SIZE);
+    }
+#endif
+  }
+
+  // Falls back to the threaded interpreter when no executable memory could
+  // be mapped (or the host isn't x86-64).
+  void run() {
+    if (code == nullptr) {
+      sim.run_threaded();
+      return;
+    }
+
+    // Memory is about to be written behind the threaded engine's back.
+    sim.predecoded = false;
+
+    State state{sim.CON.data(),
+                translated.data(),
+                sim.R,
+                LazyConditionCode(sim.codes).bits(),
+                sim.PC,
+                0,
+                nullptr,
+                sim.CON.dirty_lines(),
+                sim.executed};
+
+    const uint8_t *target = nullptr;
+    bool waiting = false;
+
+    while (!sim.halted() && !waiting) {
+      if (target == nullptr) {
+        target = block(static_cast<uint16_t>(state.pc));
+      }
+
+      protect(false);
+      const auto reason = enter(&state, target);
+      target = nullptr;
+      sim.executed = state.executed;
+
+      switch (reason) {
+      case CHAIN: {
+        flushed = false;
+        const uint8_t *next = block(static_cast<uint16_t>(state.pc));
+        if (!flushed) {
+          protect(true);
+          patch(state.patch, next);
+        }
+        target = next;
+        break;
+      }
+      case INVALIDATE: {
+        flush();
+        break;
+      }
+      case INTERPRET: {
+        const uint16_t pc = static_cast<uint16_t>(state.pc);
+        const MicroOp op{sim.CON.fetch(pc)};
+
+        state.pc = static_cast<uint16_t>(pc + 1);
+
+        switch (op.opcode << 12) {
+        case Simulator::IN: {
+          if (!sim.can_read()) {
+            state.pc = pc;
+            waiting = true;
+            break;
+          }
+          ++sim.executed;
+          sim.CON.store(op.operand, sim.read());
+          if (translated[op.operand] != 0) {
+            flush();
+          }
+          break;
+        }
+        case Simulator::OUT: {
+          ++sim.executed;
+          sim.emit(sim.CON(op.operand));
+          break;
+        }
+        case Simulator::HALT: {
+          ++sim.executed;
+          sim.is_halted = true;
+          break;
+        }
+        }
+        state.executed = sim.executed;
+        break;
+      }
+      }
+    }
+
+    sim.R = static_cast<uint16_t>(state.R);
+    sim.PC = static_cast<uint16_t>(state.pc);
+    sim.codes = LazyConditionCode(state.difference).materialise();
+  }
+
+private:
+  // Shared with generated code, which addresses it through rbp; the layout
+  // is fixed by the offsets below.
+  struct State {
+    uint16_t *memory;
+    uint8_t *translated;
+    uint32_t R;
+    uint32_t difference;
+    uint32_t pc;
+    uint32_t unused;
+    uint8_t *patch;
+    uint8_t *dirty;
+    uint64_t executed;
+  };
+
+  static constexpr int8_t MEMORY_OFFSET = 0;
+  static constexpr int8_t TRANSLATED_OFFSET = 8;
+  static constexpr int8_t R_OFFSET = 16;
+  static constexpr int8_t DIFFERENCE_OFFSET = 20;
+  static constexpr int8_t PC_OFFSET = 24;
+  static constexpr int8_t PATCH_OFFSET = 32;
+  static constexpr int8_t DIRTY_OFFSET = 40;
+  static constexpr int8_t EXECUTED_OFFSET = 48;
+
+  static_assert(offsetof(State, memory) == MEMORY_OFFSET);
+  static_assert(offsetof(State, translated) == TRANSLATED_OFFSET);
+  static_assert(offsetof(State, R) == R_OFFSET);
+  static_assert(offsetof(State, difference) == DIFFERENCE_OFFSET);
+  static_assert(offsetof(State, pc) == PC_OFFSET);
+  static_assert(offsetof(State, patch) == PATCH_OFFSET);
+  static_assert(offsetof(State, dirty) == DIRTY_OFFSET);
+  static_assert(offsetof(State, executed) == EXECUTED_OFFSET);
+
+  enum Exit : uint32_t {
+    // Leave to translate the block at state.pc and link state.patch to it.
+    CHAIN,
+    // A write landed on translated code; resume at state.pc after a flush.
+    INVALIDATE,
+    // Carry out the IN, OUT or HALT at state.pc.
+    INTERPRET,
+  };
+
+  using Entry = Exit (*)(State *, const uint8_t *);
+
+  static constexpr std::size_t CACHE_SIZE = 4 << 20;
+  static constexpr int MAX_BLOCK_INSTRUCTIONS = 256;
+  // Generous upper bound on the code emitted for a single instruction.
+  static constexpr std::size_t MAX_INSTRUCTION_BYTES = 96;
+
+  Simulator &sim;
+
+  uint8_t *code{nullptr};
+  uint8_t *cursor{nullptr};
+  uint8_t *blocks_start{nullptr};
+  Entry enter{nullptr};
+  uint8_t *epilogue{nullptr};
+  bool flushed{false};
+  bool writable{true};
+
+  std::vector<uint8_t> translated = std::vector<uint8_t>(0x10000);
+  std::vector<const uint8_t *> blocks =
+      std::vector<const uint8_t *>(0x10000, nullptr);
+
+  // Makes the code cache writable, or executable, if it isn't already.
+  // Returns whether it is now.
+  bool protect(bool write) {
+#if defined(SIMULATOR_HAS_JIT)
+    if (write != writable) {
+      if (mprotect(code, CACHE_SIZE,
+                   write ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) !=
+          0) {
+        return false;
+      }
+      writable = write;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void byte(uint8_t value) { *cursor++ = value; }
+
+  void bytes(std::initializer_list<uint8_t> values) {
+    for (auto value : values) {
+      byte(value);
+    }
+  }
+
+  void imm16(uint16_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+  }
+
+  void imm32(uint32_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+  }
+
+  void imm64(uint64_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+  }
+
+  static void patch(uint8_t *site, const uint8_t *target) {
+    const auto rel = static_cast<int32_t>(target - (site + 4));
+    std::memcpy(site, &rel, sizeof(rel));
+  }
+
+  // Displacement of word X from r14, the base of memory.
+  static uint32_t word(uint16_t X) {
+    return static_cast<uint32_t>(Memory::index(X)) * 2;
+  }
+
+  void emit_trampolines() {
+    cursor = code;
+
+    enter = reinterpret_cast<Entry>(cursor);
+    bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    bytes({0x48, 0x83, 0xEC, 0x08});                   // sub rsp, 8
+    bytes({0x48, 0x89, 0xFD});                         // mov rbp, rdi
+    bytes({0x4C, 0x8B, 0x75, MEMORY_OFFSET});          // mov r14, [rbp+]
+    bytes({0x4C, 0x8B, 0x7D, TRANSLATED_OFFSET});      // mov r15, [rbp+]
+    bytes({0x8B, 0x5D, R_OFFSET});                     // mov ebx, [rbp+]
+    bytes({0x44, 0x8B, 0x65, DIFFERENCE_OFFSET});      // mov r12d, [rbp+]
+    bytes({0x4C, 0x8B, 0x5D, DIRTY_OFFSET});           // mov r11, [rbp+]
+    bytes({0xFF, 0xE6});                               // jmp rsi
+
+    epilogue = cursor;
+    bytes({0x89, 0x5D, R_OFFSET});                     // mov [rbp+], ebx
+    bytes({0x44, 0x89, 0x65, DIFFERENCE_OFFSET});      // mov [rbp+], r12d
+    bytes({0x44, 0x89, 0x6D, PC_OFFSET});              // mov [rbp+], r13d
+    bytes({0x48, 0x89, 0x4D, PATCH_OFFSET});           // mov [rbp+], rcx
+    bytes({0x48, 0x83, 0xC4, 0x08});                   // add rsp, 8
+    bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3});
+
+    blocks_start = cursor;
+  }
+
+  void flush() {
+    std::fill(translated.begin(), translated.end(), 0);
+    std::fill(blocks.begin(), blocks.end(), nullptr);
+    cursor = blocks_start;
+    flushed = true;
+  }
+
+  // mov r13d, pc; mov eax, reason; jmp epilogue
+  void emit_exit(uint16_t pc, Exit reason) {
+    bytes({0x41, 0xBD});
+    imm32(pc);
+    byte(0xB8);
+    imm32(reason);
+    byte(0xE9);
+    patch(cursor, epilogue);
+    cursor += 4;
+  }
+
+  // add qword [rbp+], ran, counting the instructions a block has run on
+  // the way out of it.
+  void emit_count(int ran) {
+    if (ran != 0) {
+      bytes({0x48, 0x81, 0x45, EXECUTED_OFFSET});
+      imm32(static_cast<uint32_t>(ran));
+    }
+  }
+
+  // Leaves room for the rel32 of a jump whose opcode bytes have just been
+  // emitted, to be filled in by link().
+  uint8_t *reserve() {
+    uint8_t *site = cursor;
+    cursor += 4;
+    return site;
+  }
+
+  // Points a jump at the block for pc, or, until that has been translated,
+  // at a stub (emitted here) which asks for it to be translated and linked.
+  void link(uint8_t *site, uint16_t pc) {
+    if (blocks[pc] != nullptr) {
+      patch(site, blocks[pc]);
+      return;
+    }
+
+    patch(site, cursor);
+    bytes({0x48, 0xB9}); // mov rcx, site
+    imm64(reinterpret_cast<uint64_t>(site));
+    emit_exit(pc, CHAIN);
+  }
+
+  // Finishes a conditional jump (whose jcc opcode has just been emitted)
+  // with a jump to the fall-through, keeping any stubs out of line.
+  void emit_conditional(uint16_t taken, uint16_t fallthrough) {
+    uint8_t *taken_site = reserve();
+    byte(0xE9);
+    uint8_t *fallthrough_site = reserve();
+    link(taken_site, taken);
+    link(fallthrough_site, fallthrough);
+  }
+
+  // After a write to X, the ran-th instruction of the block: mark its line
+  // dirty, and leave the block if X holds translated code.
+  void emit_write_check(uint16_t X, uint16_t next, int ran) {
+    bytes({0x41, 0x80, 0x8B}); // or byte [r11+line], bit
+    imm32(Memory::dirty_byte(X));
+    byte(Memory::dirty_bit(X));
+
+    bytes({0x41, 0x80, 0xBF}); // cmp byte [r15+X], 0
+    imm32(X);
+    byte(0x00);
+    bytes({0x74, 24}); // je past the exit
+    emit_count(ran);
+    emit_exit(next, INVALIDATE);
+  }
+
+  const uint8_t *block(uint16_t start) {
+    if (blocks[start] != nullptr) {
+      return blocks[start];
+    }
+    protect(true);
+
+    const std::size_t needed =
+        MAX_BLOCK_INSTRUCTIONS * MAX_INSTRUCTION_BYTES + MAX_INSTRUCTION_BYTES;
+    if (static_cast<std::size_t>(code + CACHE_SIZE - cursor) < needed) {
+      flush();
+    }
+
+    uint8_t *entry = cursor;
+    blocks[start] = entry;
+
+    uint16_t pc = start;
+    int ran = 0;
+    while (ran < MAX_BLOCK_INSTRUCTIONS) {
+      const MicroOp op{sim.CON.fetch(pc)};
+      const uint16_t X = op.operand;
+      const uint16_t next = static_cast<uint16_t>(pc + 1);
+
+      translated[pc] = 1;
+      ++ran;
+
+      switch (op.opcode << 12) {
+      case Simulator::LOAD: {
+        bytes({0x41, 0x0F, 0xB7, 0x9E}); // movzx ebx, word [r14+X]
+        imm32(word(X));
+        break;
+      }
+      case Simulator::STORE: {
+        bytes({0x66, 0x41, 0x89, 0x9E}); // mov word [r14+X], bx
+        imm32(word(X));
+        emit_write_check(X, next, ran);
+        break;
+      }
+      case Simulator::CLEAR: {
+        bytes({0x66, 0x41, 0xC7, 0x86}); // mov word [r14+X], 0
+        imm32(word(X));
+        imm16(0);
+        emit_write_check(X, next, ran);
+        break;
+      }
+      case Simulator::ADD: {
+        bytes({0x66, 0x41, 0x03, 0x9E}); // add bx, word [r14+X]
+        imm32(word(X));
+        break;
+      }
+      case Simulator::INC: {
+        bytes({0x66, 0x41, 0x83, 0x86}); // add word [r14+X], 1
+        imm32(word(X));
+        byte(0x01);
+        emit_write_check(X, next, ran);
+        break;
+      }
+      case Simulator::SUB: {
+        bytes({0x66, 0x41, 0x2B, 0x9E}); // sub bx, word [r14+X]
+        imm32(word(X));
+        break;
+      }
+      case Simulator::DEC: {
+        bytes({0x66, 0x41, 0x83, 0xAE}); // sub word [r14+X], 1
+        imm32(word(X));
+        byte(0x01);
+        emit_write_check(X, next, ran);
+        break;
+      }
+      case Simulator::COMP: {
+        bytes({0x45, 0x0F, 0xB7, 0xA6}); // movzx r12d, word [r14+X]
+        imm32(word(X));
+        bytes({0x41, 0x29, 0xDC}); // sub r12d, ebx
+        break;
+      }
+      case Simulator::JUMP: {
+        emit_count(ran);
+        byte(0xE9);
+        link(reserve(), X);
+        return entry;
+      }
+      case Simulator::JGT:
+      case Simulator::JLT: {
+        emit_count(ran);
+        if (op.opcode << 12 == Simulator::JGT) {
+          bytes({0x41, 0x8D, 0x44, 0x24, 0xFF}); // lea eax, [r12-1]
+        } else {
+          bytes({0x41, 0x8D, 0x84, 0x24}); // lea eax, [r12+0xFFFF]
+          imm32(0xFFFF);
+        }
+        byte(0x3D); // cmp eax, 0xFFFF
+        imm32(0xFFFF);
+        bytes({0x0F, 0x82}); // jb
+        emit_conditional(X, next);
+        return entry;
+      }
+      case Simulator::JEQ:
+      case Simulator::JNEQ: {
+        emit_count(ran);
+        bytes({0x45, 0x85, 0xE4}); // test r12d, r12d
+        bytes({0x0F, static_cast<uint8_t>(
+                         op.opcode << 12 == Simulator::JEQ ? 0x84 : 0x85)});
+        emit_conditional(X, next);
+        return entry;
+      }
+      case Simulator::IN:
+      case Simulator::OUT:
+      case Simulator::HALT: {
+        // Carried out, and counted, outside the generated code.
+        emit_count(ran - 1);
+        emit_exit(pc, INTERPRET);
+        return entry;
+      }
+      }
+
+      pc = next;
+      if (pc == 0) {
+        break;
+      }
+    }
+
+    emit_count(ran);
+    byte(0xE9);
+    link(reserve(), pc);
+    return entry;
+  }
+};
+
+#endif // JIT_HPP
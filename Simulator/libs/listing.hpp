@@ -0,0 +1,108 @@
+#ifndef LISTING_HPP
+#define LISTING_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+
+// What the assembler says about a program: the source line each address
+// came from, from the .lst file, and the address of each label, from the
+// .sym file. Either may be missing, which just leaves it empty.
+struct Listing {
+  struct Line {
+    std::size_t number;
+    std::string text;
+
+    // Whether it's a directive, such as .DATA, rather than an instruction.
+    bool directive() const {
+      return text.rfind('.', 0) == 0 || text.find(" .") != std::string::npos;
+    }
+  };
+
+  std::map<uint16_t, Line> lines{};
+  std::map<uint16_t, std::string> labels{};
+
+  // Reads the .lst and .sym files the assembler wrote next to an object
+  // file.
+  static Listing beside(const std::filesystem::path &object) {
+    Listing listing;
+    listing.read_lines(std::filesystem::path(object).replace_extension(".lst"));
+    listing.read_labels(
+        std::filesystem::path(object).replace_extension(".sym"));
+    return listing;
+  }
+
+  // The label an address comes under: the last one at or before it.
+  const std::string *label(uint16_t address) const {
+    auto at = labels.upper_bound(address);
+    return at == labels.begin() ? nullptr : &std::prev(at)->second;
+  }
+
+private:
+  static bool hex(const std::string &text, uint16_t &value) {
+    const auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), value, 16);
+    return error == std::errc() && end == text.data() + text.size();
+  }
+
+  // Each line is "(address) hex binary (line) label instruction", with the
+  // label padded out to a column of its own.
+  void read_lines(const std::filesystem::path &path) {
+    std::ifstream file(path);
+    for (std::string line; std::getline(file, line);) {
+      const auto close = line.find(')');
+      const auto open = line.find('(', close);
+      const auto end = line.find(')', open);
+      uint16_t address = 0;
+      if (line.empty() || line[0] != '(' || end == std::string::npos ||
+          !hex(line.substr(1, close - 1), address)) {
+        continue;
+      }
+
+      std::size_t number = 0;
+      std::string digits = line.substr(open + 1, end - open - 1);
+      digits.erase(0, digits.find_first_not_of(' '));
+      std::from_chars(digits.data(), digits.data() + digits.size(), number);
+
+      std::string text;
+      for (std::size_t i = end + 1; i < line.size(); ++i) {
+        if (!std::isspace(static_cast<unsigned char>(line[i]))) {
+          text += line[i];
+        } else if (!text.empty() && text.back() != ' ') {
+          text += ' ';
+        }
+      }
+      if (!text.empty() && text.back() == ' ') {
+        text.pop_back();
+      }
+      lines[address] = {number, text};
+    }
+  }
+
+  // Each label is on a line "//\tname address", under a few lines of
+  // heading.
+  void read_labels(const std::filesystem::path &path) {
+    std::ifstream file(path);
+    for (std::string line; std::getline(file, line);) {
+      std::istringstream fields(line.substr(std::min<std::size_t>(
+          line.size(), line.rfind("//", 0) == 0 ? 2 : line.size())));
+      std::string name;
+      std::string address;
+      std::string rest;
+      uint16_t value = 0;
+      if (fields >> name >> address && !(fields >> rest) &&
+          hex(address, value)) {
+        labels[value] = name;
+      }
+    }
+  }
+};
+
+#endif // LISTING_HPP
@@ -0,0 +1,343 @@
+#ifndef LOCKSTEP_HPP
+#define LOCKSTEP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "simulator.hpp"
+
+#if defined(__GNUC__)
+#define SIMULATOR_HAS_LOCKSTEP 1
+
+// Runs one program against many input vectors at once. Lanes are processed
+// in groups of sixteen, one group at a time; each group keeps its lanes'
+// R, PC, condition codes and memory in structure-of-arrays form (each
+// memory word is a vector of sixteen lanes) so that one instruction is
+// carried out for the whole group with a handful of vector operations. The
+// kernel is compiled twice, once for AVX2 and once for the baseline
+// instruction set, and the AVX2 one is used when the CPU supports it.
+//
+// While every running lane in a group is at the same PC the group moves as
+// one. A conditional jump which splits the group (or a word which differs
+// between lanes, after self-modifying code) makes it diverge: from then on
+// the lowest PC among the running lanes is executed, masked to the lanes
+// sitting at it, until they all meet at the same PC again. To stop a lane
+// that never gets there from starving the rest, the lowest PC above the
+// last one picked is taken instead every QUANTUM divergent steps.
+//
+// A lane which HALTs, or reaches an IN with its input used up, retires
+// from the group; the others carry on without it.
+class Lockstep {
+public:
+  enum class Status {
+    RUNNING,
+    HALTED,
+    WAITING_FOR_INPUT,
+  };
+
+  struct Lane {
+    std::vector<int16_t> input;
+    std::size_t consumed{0};
+    std::vector<int16_t> output;
+    Status status{Status::RUNNING};
+  };
+
+  static constexpr int WIDTH = 16;
+
+  Lockstep(std::vector<uint16_t> program,
+           std::vector<std::vector<int16_t>> inputs)
+      : image(std::move(program)), all(inputs.size()) {
+    for (std::size_t lane = 0; lane < inputs.size(); ++lane) {
+      all[lane].input = std::move(inputs[lane]);
+    }
+  }
+
+  void run() {
+    // Not a std::vector, which would drop the alignment of its elements.
+    Vector *memory = new Vector[0x1000];
+
+    for (std::size_t first = 0; first < all.size(); first += WIDTH) {
+      std::fill(memory, memory + 0x1000, Vector{});
+      for (std::size_t i = 0; i < image.size() && i < 0x10000; ++i) {
+        const auto address = static_cast<uint16_t>(i);
+        if (Memory::addressable(address)) {
+          broadcast(memory[Memory::index(address)], image[i]);
+        }
+      }
+
+      const int count =
+          static_cast<int>(std::min<std::size_t>(WIDTH, all.size() - first));
+#if defined(__x86_64__) || defined(__i386__)
+      if (__builtin_cpu_supports("avx2")) {
+        run_group_avx2(memory, image, &all[first], count);
+        continue;
+      }
+#endif
+      run_group_generic(memory, image, &all[first], count);
+    }
+
+    delete[] memory;
+  }
+
+  const std::vector<Lane> &lanes() const { return all; }
+
+private:
+  // Aligned explicitly, since without AVX enabled the compiler would only
+  // give the memory vectors sixteen byte alignment.
+  using Vector =
+      uint16_t __attribute__((vector_size(2 * WIDTH), aligned(2 * WIDTH)));
+  using Mask =
+      int16_t __attribute__((vector_size(2 * WIDTH), aligned(2 * WIDTH)));
+
+  static constexpr int QUANTUM = 4096;
+
+  std::vector<uint16_t> image;
+  std::vector<Lane> all;
+
+  // The helpers take and give vectors by reference, since passing AVX
+  // vectors by value has an ABI of its own, which depends on whether AVX
+  // is enabled, and the compiler warns about it.
+  __attribute__((always_inline)) static void broadcast(Vector &into,
+                                                       uint16_t value) {
+    into = Vector{} + value;
+  }
+
+  static constexpr Vector LANE_BITS = {1 << 0,  1 << 1,  1 << 2,  1 << 3,
+                                       1 << 4,  1 << 5,  1 << 6,  1 << 7,
+                                       1 << 8,  1 << 9,  1 << 10, 1 << 11,
+                                       1 << 12, 1 << 13, 1 << 14, 1 << 15};
+
+  // Each lane contributes a different bit, so OR-ing the lanes together
+  // (four at a time, then within a word) gives the mask as an integer.
+  __attribute__((always_inline)) static uint32_t bits(const Mask &mask) {
+    const Vector lanes = (Vector)mask & LANE_BITS;
+    uint64_t words[sizeof(Vector) / sizeof(uint64_t)];
+    std::memcpy(words, &lanes, sizeof(words));
+
+    uint64_t result = words[0] | words[1] | words[2] | words[3];
+    result |= result >> 32;
+    result |= result >> 16;
+    return static_cast<uint32_t>(result & 0xFFFF);
+  }
+
+  // Sets every bit of the lanes given, and clears the rest.
+  __attribute__((always_inline)) static void expand(Vector &into,
+                                                    uint32_t lanes) {
+    into = (Vector)((LANE_BITS & static_cast<uint16_t>(lanes)) != 0);
+  }
+
+  // Replaces into with value in the lanes set in mask.
+  __attribute__((always_inline)) static void
+  blend(Vector &into, const Vector &mask, const Vector &value) {
+    into = (value & mask) | (into & ~mask);
+  }
+
+  __attribute__((always_inline)) static void blend(Vector &into,
+                                                   uint32_t lanes,
+                                                   uint16_t value) {
+    Vector mask;
+    expand(mask, lanes);
+    Vector values;
+    broadcast(values, value);
+    blend(into, mask, values);
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("avx2"))) static void
+  run_group_avx2(Vector *memory, const std::vector<uint16_t> &image,
+                 Lane *lanes, int count) {
+    run_group(memory, image, lanes, count);
+  }
+#endif
+
+  static void run_group_generic(Vector *memory,
+                                const std::vector<uint16_t> &image,
+                                Lane *lanes, int count) {
+    run_group(memory, image, lanes, count);
+  }
+
+  // memory holds the addressable window of the Memory class; anything else
+  // is only ever executed, straight out of the image.
+  __attribute__((always_inline)) static void
+  run_group(Vector *memory, const std::vector<uint16_t> &image, Lane *lanes,
+            int count) {
+    Vector R{};
+    Vector GT{};
+    Vector EQ{};
+    Vector LT{};
+    Vector PC{};
+
+    uint32_t running = (1U << count) - 1;
+    bool converged = true;
+    uint16_t pc = 0;
+    uint16_t floor = 0;
+    int divergent = 0;
+
+    while (running != 0) {
+      uint32_t active = running;
+
+      if (!converged) {
+        bool found = false;
+        uint16_t lowest = 0;
+        for (int pass = 0; pass < 2 && !found; ++pass) {
+          for (int lane = 0; lane < count; ++lane) {
+            if ((running >> lane & 1) != 0 &&
+                (pass == 1 || PC[lane] >= floor) &&
+                (!found || PC[lane] < lowest)) {
+              lowest = PC[lane];
+              found = true;
+            }
+          }
+        }
+        pc = lowest;
+        active = running & bits((Mask)(PC == pc));
+
+        if (++divergent == QUANTUM) {
+          divergent = 0;
+          floor = static_cast<uint16_t>(pc + 1);
+        }
+      }
+
+      Vector words;
+      if (Memory::addressable(pc)) {
+        words = memory[Memory::index(pc)];
+      } else {
+        broadcast(words, pc < image.size() ? image[pc] : 0);
+      }
+      const uint16_t instruction = words[__builtin_ctz(active)];
+      const uint32_t same = active & bits((Mask)(words == instruction));
+      if (same != active) {
+        diverge(PC, pc, running, converged);
+        active = same;
+      }
+
+      Vector M;
+      expand(M, active);
+      const MicroOp op{instruction};
+      Vector &X = memory[Memory::index(op.operand)];
+      const uint16_t next = static_cast<uint16_t>(pc + 1);
+      uint16_t target = next;
+
+      switch (op.opcode << 12) {
+      case Simulator::LOAD:
+        blend(R, M, X);
+        break;
+      case Simulator::STORE:
+        blend(X, M, R);
+        break;
+      case Simulator::CLEAR:
+        X &= ~M;
+        break;
+      case Simulator::ADD:
+        blend(R, M, R + X);
+        break;
+      case Simulator::INC:
+        X -= M;
+        break;
+      case Simulator::SUB:
+        blend(R, M, R - X);
+        break;
+      case Simulator::DEC:
+        X += M;
+        break;
+      case Simulator::COMP:
+        blend(GT, M, (Vector)(X > R));
+        blend(EQ, M, (Vector)(X == R));
+        blend(LT, M, (Vector)(X < R));
+        break;
+      case Simulator::JUMP:
+        target = op.operand;
+        break;
+      case Simulator::JGT:
+      case Simulator::JEQ:
+      case Simulator::JLT:
+      case Simulator::JNEQ: {
+        Vector condition = op.opcode << 12 == Simulator::JGT   ? GT
+                           : op.opcode << 12 == Simulator::JEQ ? EQ
+                           : op.opcode << 12 == Simulator::JLT ? LT
+                                                               : ~EQ;
+        const uint32_t taken = active & bits((Mask)condition);
+
+        if (taken == active) {
+          target = op.operand;
+        } else if (taken != 0) {
+          diverge(PC, pc, running, converged);
+          blend(PC, taken, op.operand);
+          blend(PC, active & ~taken, next);
+          continue;
+        }
+        break;
+      }
+      case Simulator::IN:
+        for (int lane = 0; lane < count; ++lane) {
+          if ((active >> lane & 1) == 0) {
+            continue;
+          }
+
+          Lane &current = lanes[lane];
+          if (current.consumed == current.input.size()) {
+            current.status = Status::WAITING_FOR_INPUT;
+            running &= ~(1U << lane);
+            active &= ~(1U << lane);
+            PC[lane] = pc;
+            continue;
+          }
+          X[lane] = static_cast<uint16_t>(current.input[current.consumed++]);
+        }
+        break;
+      case Simulator::OUT:
+        for (int lane = 0; lane < count; ++lane) {
+          if ((active >> lane & 1) != 0) {
+            lanes[lane].output.push_back(static_cast<int16_t>(X[lane]));
+          }
+        }
+        break;
+      case Simulator::HALT:
+        for (int lane = 0; lane < count; ++lane) {
+          if ((active >> lane & 1) != 0) {
+            lanes[lane].status = Status::HALTED;
+            PC[lane] = next;
+          }
+        }
+        running &= ~active;
+        active = 0;
+        break;
+      }
+
+      if (converged) {
+        pc = target;
+        continue;
+      }
+
+      blend(PC, active, target);
+
+      // Lanes which have all met up again move as one group.
+      bool together = running != 0;
+      const uint16_t first = PC[running != 0 ? __builtin_ctz(running) : 0];
+      for (int lane = 0; lane < count && together; ++lane) {
+        together = (running >> lane & 1) == 0 || PC[lane] == first;
+      }
+      if (together) {
+        converged = true;
+        pc = first;
+        divergent = 0;
+        floor = 0;
+      }
+    }
+  }
+
+  // Moves a converged group over to tracking a PC per lane.
+  __attribute__((always_inline)) static void
+  diverge(Vector &PC, uint16_t pc, uint32_t running, bool &converged) {
+    if (converged) {
+      blend(PC, running, pc);
+      converged = false;
+    }
+  }
+};
+
+#endif
+
+#endif // LOCKSTEP_HPP
@@ -0,0 +1,102 @@
+#ifndef PREFIX_TREE_HPP
+#define PREFIX_TREE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "simulator.hpp"
+
+// Runs one program against many input vectors, sharing the work common to
+// vectors which start the same way. The vectors are arranged in a trie: the
+// program runs up to its first IN once, and at every IN the simulator is
+// copied for each distinct value the vectors below that point give it next,
+// so no prefix is executed more than once. Copies share the program image
+// (and any memory neither side has written since), so they're cheap.
+//
+// A vector's run ends when the program HALTs, or reaches an IN with the
+// vector used up.
+class PrefixTree {
+public:
+  enum class Status {
+    HALTED,
+    WAITING_FOR_INPUT,
+  };
+
+  struct Run {
+    std::vector<int16_t> output;
+    Status status{Status::HALTED};
+  };
+
+  explicit PrefixTree(std::vector<std::vector<int16_t>> inputs)
+      : vectors(std::move(inputs)), all(vectors.size()) {}
+
+  // Runs the program loaded into root, with engine(simulator) running a
+  // simulator until it halts, pauses or waits for input.
+  template <typename Engine> void run(Simulator root, Engine &&engine) {
+    // Sorted, vectors with a common prefix sit next to each other, and one
+    // which ends at a node comes before any that carry on past it.
+    std::vector<std::size_t> order(vectors.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [this](std::size_t a, std::size_t b) {
+                       return vectors[a] < vectors[b];
+                     });
+
+    root.capture_output();
+    root.feed({});
+
+    struct Node {
+      Simulator sim;
+      std::size_t depth;
+      std::size_t first;
+      std::size_t last;
+    };
+    std::vector<Node> pending;
+    pending.push_back({std::move(root), 0, 0, order.size()});
+
+    while (!pending.empty()) {
+      Node node = std::move(pending.back());
+      pending.pop_back();
+
+      Simulator &sim = node.sim;
+      while (!sim.halted() && !sim.waiting_for_input()) {
+        engine(sim);
+      }
+
+      std::size_t first = node.first;
+      for (; first < node.last &&
+             (sim.halted() || vectors[order[first]].size() == node.depth);
+           ++first) {
+        all[order[first]] = {sim.captured_output(),
+                             sim.halted() ? Status::HALTED
+                                          : Status::WAITING_FOR_INPUT};
+      }
+
+      // One child per distinct next value. The last one takes this node's
+      // simulator rather than a copy of it.
+      while (first < node.last) {
+        const int16_t value = vectors[order[first]][node.depth];
+        std::size_t last = first;
+        while (last < node.last && vectors[order[last]][node.depth] == value) {
+          ++last;
+        }
+
+        Simulator child = last == node.last ? std::move(sim) : sim;
+        child.feed({value});
+        pending.push_back({std::move(child), node.depth + 1, first, last});
+        first = last;
+      }
+    }
+  }
+
+  const std::vector<Run> &runs() const { return all; }
+
+private:
+  std::vector<std::vector<int16_t>> vectors;
+  std::vector<Run> all;
+};
+
+#endif // PREFIX_TREE_HPP
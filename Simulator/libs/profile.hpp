@@ -0,0 +1,223 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "listing.hpp"
+#include "simulator.hpp"
+
+// How many times each address was executed, and how many times each word
+// in the data window was loaded from and stored to, in a run made after
+// count_jumps(). Each address's count comes from executions(), so the
+// run can be made with either engine at full speed, and each word's counts
+// from the counts of the instructions that use it. Every operand is a
+// fixed address, so that's exact, except that an instruction rewritten
+// while the program ran has all its executions put down to what it was
+// rewritten to last.
+struct Profile {
+  std::vector<uint64_t> executions = std::vector<uint64_t>(0x10000);
+  std::vector<uint64_t> loads = std::vector<uint64_t>(Memory::WORDS);
+  std::vector<uint64_t> stores = std::vector<uint64_t>(Memory::WORDS);
+
+  template <typename Engine> static Profile of(const Engine &sim) {
+    Profile profile;
+    profile.executions = sim.executions();
+    for (uint32_t at = 0; at < 0x10000; ++at) {
+      const uint64_t count = profile.executions[at];
+      if (count == 0) {
+        continue;
+      }
+      const uint16_t instruction = sim.memory(static_cast<uint16_t>(at));
+      const uint16_t word =
+          Memory::index(MicroOp::decode_operand(instruction));
+      switch (instruction & 0xF000) {
+      case Engine::LOAD:
+      case Engine::ADD:
+      case Engine::SUB:
+      case Engine::COMP:
+      case Engine::OUT:
+        profile.loads[word] += count;
+        break;
+      case Engine::STORE:
+      case Engine::CLEAR:
+      case Engine::IN:
+        profile.stores[word] += count;
+        break;
+      case Engine::INC:
+      case Engine::DEC:
+        profile.loads[word] += count;
+        profile.stores[word] += count;
+        break;
+      default:
+        break;
+      }
+    }
+    return profile;
+  }
+};
+
+// Prints where a profiled run spent its time: the instructions executed
+// most, the data words used most, the labels whose code and data were
+// busiest, and the loops that ran longest. A loop is taken to be each
+// stretch of code from a jump back to where it jumps to, so loops inside
+// others are reported as well as the loops around them.
+inline void report_profile(const Profile &profile,
+                           const std::vector<uint16_t> &image,
+                           const Listing &listing, uint64_t instructions,
+                           std::ostream &out) {
+  static constexpr std::size_t SHOWN{10};
+
+  const auto percent = [instructions](uint64_t count) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1)
+         << (instructions == 0 ? 0.0
+                               : 100.0 * static_cast<double>(count) /
+                                     static_cast<double>(instructions))
+         << '%';
+    return text.str();
+  };
+  const auto address = [](uint16_t at) {
+    std::ostringstream text;
+    text << std::hex << std::uppercase << std::setfill('0') << std::setw(4)
+         << at;
+    return text.str();
+  };
+  // The source for an address, or failing that its disassembly.
+  const auto source = [&listing, &image](uint16_t at) {
+    if (const auto line = listing.lines.find(at);
+        line != listing.lines.end()) {
+      return "line " + std::to_string(line->second.number) + ": " +
+             line->second.text;
+    }
+    const uint16_t word = at < image.size() ? image[at] : 0;
+    std::ostringstream text;
+    text << Simulator::mnemonic(word) << ' ' << std::hex << std::uppercase
+         << static_cast<uint16_t>(MicroOp::decode_operand(word));
+    return text.str();
+  };
+  const auto top = [](std::vector<uint16_t> &order, const auto &weight) {
+    std::stable_sort(order.begin(), order.end(),
+                     [&weight](uint16_t a, uint16_t b) {
+                       return weight(a) > weight(b);
+                     });
+    order.resize(std::min(order.size(), SHOWN));
+  };
+
+  std::vector<uint16_t> hot;
+  for (uint32_t at = 0; at < profile.executions.size(); ++at) {
+    if (profile.executions[at] != 0) {
+      hot.push_back(static_cast<uint16_t>(at));
+    }
+  }
+  const std::vector<uint16_t> executed = hot;
+  top(hot, [&profile](uint16_t at) { return profile.executions[at]; });
+  out << "Hottest instructions (of " << instructions << " executed)\n";
+  for (const auto at : hot) {
+    out << "  " << address(at) << std::setw(14) << profile.executions[at]
+        << std::setw(8) << percent(profile.executions[at]) << "  "
+        << source(at) << '\n';
+  }
+
+  // Data words are reported at the address their index maps back to.
+  const auto word = [](int i) {
+    return static_cast<uint16_t>(i < 0x0800 ? i : i | 0xF000);
+  };
+  const auto accesses = [&profile](uint16_t at) {
+    return profile.loads[Memory::index(at)] +
+           profile.stores[Memory::index(at)];
+  };
+  std::vector<uint16_t> busy;
+  for (int i = 0; i < Memory::WORDS; ++i) {
+    if (accesses(word(i)) != 0) {
+      busy.push_back(word(i));
+    }
+  }
+  top(busy, accesses);
+  out << "Busiest data words (loads, stores)\n";
+  for (const auto at : busy) {
+    out << "  " << address(at) << std::setw(14)
+        << profile.loads[Memory::index(at)] << std::setw(14)
+        << profile.stores[Memory::index(at)] << "  " << source(at) << '\n';
+  }
+
+  if (!listing.labels.empty()) {
+    struct Totals {
+      uint64_t executions{0};
+      uint64_t accesses{0};
+    };
+    std::map<uint16_t, Totals> totals;
+    const auto under = [&listing](uint16_t at) {
+      const auto label = listing.labels.upper_bound(at);
+      return label == listing.labels.begin() ? std::optional<uint16_t>()
+                                             : std::prev(label)->first;
+    };
+    for (const auto at : executed) {
+      if (const auto label = under(at)) {
+        totals[*label].executions += profile.executions[at];
+      }
+    }
+    for (int i = 0; i < Memory::WORDS; ++i) {
+      if (const auto label = under(word(i)); label && accesses(word(i)) != 0) {
+        totals[*label].accesses += accesses(word(i));
+      }
+    }
+
+    std::vector<uint16_t> labels;
+    for (const auto &[at, _] : totals) {
+      labels.push_back(at);
+    }
+    top(labels, [&totals](uint16_t at) {
+      return totals[at].executions + totals[at].accesses;
+    });
+    out << "Busiest labels (instructions executed, data loads and stores)\n";
+    for (const auto at : labels) {
+      out << "  " << address(at) << std::setw(14) << totals[at].executions
+          << std::setw(14) << totals[at].accesses << "  "
+          << listing.labels.at(at) << '\n';
+    }
+  }
+
+  // Each jump back is the end of a loop starting where it jumps to.
+  const auto head = [&image](uint16_t at) {
+    const uint16_t instruction = at < image.size() ? image[at] : 0;
+    return static_cast<uint16_t>(MicroOp::decode_operand(instruction));
+  };
+  std::vector<uint16_t> loops;
+  for (const auto at : executed) {
+    const uint16_t code = at < image.size() ? image[at] & 0xF000 : 0;
+    if (code >= Simulator::JUMP && code <= Simulator::JNEQ && head(at) <= at) {
+      loops.push_back(at);
+    }
+  }
+  // So that each loop's total is a difference of two running totals.
+  std::vector<uint64_t> before(profile.executions.size() + 1);
+  for (std::size_t at = 0; at < profile.executions.size(); ++at) {
+    before[at + 1] = before[at] + profile.executions[at];
+  }
+  const auto spent = [&before, &head](uint16_t last) {
+    return before[last + 1U] - before[head(last)];
+  };
+  top(loops, spent);
+  out << "Longest-running loops (instructions executed, times at the head)\n";
+  for (const auto last : loops) {
+    const uint16_t first = head(last);
+    out << "  " << address(first) << '-' << address(last) << std::setw(9)
+        << spent(last) << std::setw(8) << percent(spent(last))
+        << std::setw(14) << profile.executions[first];
+    if (const auto *label = listing.label(first)) {
+      out << "  " << *label;
+    }
+    out << '\n';
+  }
+}
+
+#endif // PROFILE_HPP
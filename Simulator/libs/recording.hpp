@@ -0,0 +1,116 @@
+#ifndef RECORDING_HPP
+#define RECORDING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "simulator.hpp"
+
+// Everything a program read and wrote in one run, and how many
+// instructions the run took, as kept by Simulator::record_io().
+struct Recording {
+  std::vector<Simulator::IoEvent> events{};
+  uint64_t instructions{0};
+};
+
+// A recording file is the magic and version, the instruction count, the
+// number of events, then each event as two variable-length numbers: how
+// many instructions on from the last event it is (shifted up one, with the
+// low bit set for output), and its value zigzagged. An event takes two or
+// three bytes for most programs.
+namespace recording {
+
+constexpr char MAGIC[4] = {'M', 'N', 'I', 'O'};
+constexpr uint16_t VERSION{1};
+
+inline void put(std::vector<uint8_t> &blob, uint64_t value) {
+  while (value >= 0x80) {
+    blob.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  blob.push_back(static_cast<uint8_t>(value));
+}
+
+inline bool get(const std::vector<uint8_t> &blob, std::size_t &at,
+                uint64_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && at < blob.size(); shift += 7) {
+    const uint8_t byte = blob[at++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace recording
+
+inline bool save_recording(const Recording &run,
+                           const std::filesystem::path &path) {
+  std::vector<uint8_t> blob(std::begin(recording::MAGIC),
+                            std::end(recording::MAGIC));
+  recording::put(blob, recording::VERSION);
+  recording::put(blob, run.instructions);
+  recording::put(blob, run.events.size());
+
+  uint64_t last = 0;
+  for (const auto &event : run.events) {
+    const auto bits = static_cast<uint16_t>(event.value);
+    const auto zigzag =
+        static_cast<uint16_t>(bits << 1 ^ (event.value < 0 ? 0xFFFF : 0));
+    recording::put(blob, (event.instruction - last) << 1 | event.output);
+    recording::put(blob, zigzag);
+    last = event.instruction;
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(blob.data()),
+             static_cast<std::streamsize>(blob.size()));
+  return static_cast<bool>(file.flush());
+}
+
+inline bool load_recording(Recording &run, const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  const std::vector<uint8_t> blob(std::istreambuf_iterator<char>(file), {});
+
+  std::size_t at = sizeof(recording::MAGIC);
+  uint64_t version = 0;
+  uint64_t count = 0;
+  if (blob.size() < at ||
+      !std::equal(std::begin(recording::MAGIC), std::end(recording::MAGIC),
+                  blob.begin()) ||
+      !recording::get(blob, at, version) || version != recording::VERSION ||
+      !recording::get(blob, at, run.instructions) ||
+      !recording::get(blob, at, count) || count > blob.size()) {
+    return false;
+  }
+
+  run.events.clear();
+  run.events.reserve(count);
+  uint64_t last = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t step = 0;
+    uint64_t zigzag = 0;
+    if (!recording::get(blob, at, step) ||
+        !recording::get(blob, at, zigzag) || zigzag > 0xFFFF) {
+      return false;
+    }
+    last += step >> 1;
+    run.events.push_back(
+        {last,
+         static_cast<int16_t>(static_cast<uint16_t>(
+             zigzag >> 1 ^ ((zigzag & 1) != 0 ? 0xFFFF : 0))),
+         (step & 1) != 0});
+  }
+  return at == blob.size();
+}
+
+#endif // RECORDING_HPP
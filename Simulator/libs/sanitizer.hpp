@@ -0,0 +1,49 @@
+#ifndef SANITIZER_HPP
+#define SANITIZER_HPP
+
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "listing.hpp"
+#include "simulator.hpp"
+
+// Prints each instruction that read a word before it was given a value
+// (see BasicSimulator::sanitize()), in the order they first did: where it
+// is, the word it read and its label if it has one, and the instruction's
+// source line.
+inline void report_uninitialized(
+    const std::vector<UninitializedRead> &reads,
+    const Listing &listing, std::ostream &out) {
+  const auto address = [](uint16_t at) {
+    std::ostringstream text;
+    text << std::hex << std::uppercase << std::setfill('0') << std::setw(4)
+         << at;
+    return text.str();
+  };
+
+  for (const auto &finding : reads) {
+    out << "  " << address(finding.at) << " read "
+        << address(finding.word);
+    if (const auto label = listing.labels.find(finding.word);
+        label != listing.labels.end()) {
+      out << " (" << label->second << ')';
+    }
+    out << "  ";
+    if (const auto line = listing.lines.find(finding.at);
+        line != listing.lines.end()) {
+      out << "line " << line->second.number << ": " << line->second.text;
+    } else {
+      out << Simulator::mnemonic(finding.instruction) << ' ' << std::hex
+          << std::uppercase
+          << static_cast<uint16_t>(MicroOp::decode_operand(finding.instruction))
+          << std::dec << std::nouppercase;
+    }
+    out << '\n';
+  }
+}
+
+#endif // SANITIZER_HPP
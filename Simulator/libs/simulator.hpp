@@ -1,19 +1,339 @@
 #ifndef SIMULATOR_HPP
 #define SIMULATOR_HPP
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <type_traits>
 #include <vector>
 
+// Operands are sign-extended 12-bit values, so the only words a program
+// can read or write are those at 0x0000-0x07FF and 0xF800-0xFFFF. Their low
+// twelve bits tell them apart, which maps the window onto 4096 words one
+// to one. The rest of the address space can only be executed, and holds
+// whatever the image put there or zero.
+//
+// The window is split into 64-word chunks reached through a page table.
+// Copies of a loaded memory share one read-only base and each chunk is
+// only copied the first time it's written, so thousands of instances of
+// the same program cost little more than the chunks they store into. The
+// engines need the window contiguous; data() flattens it into a private
+// block for them the first time one runs, after which the page table
+// points into that, and a copy goes back to sharing the chunks which still
+// match the base.
+//
+// Every store also marks the cache line it lands in as dirty, so that
+// reset() only has to undo the lines the last run wrote. Once asked to, it
+// keeps a digest of the window up to date too, the XOR of a hash of each
+// word and where it is, which a store changes by two hashes. The engines
+// store through data() instead: they gather the chunks they write as a
+// mask of chunk_bit()s and pass it to wrote() when they stop, which marks
+// every line in them, and keep the digest with stored().
 class Memory {
+public:
+  static constexpr int WORDS{0x1000};
+
 private:
-  std::array<uint16_t, 0xFFFF> memory{};
+  static constexpr int LINE_WORDS{32};
+  static constexpr int LINES{WORDS / LINE_WORDS};
+  static constexpr int CHUNK_WORDS{64};
+  static constexpr int CHUNKS{WORDS / CHUNK_WORDS};
+  static constexpr uint64_t ALL_CHUNKS{~0ULL};
+
+  struct Base {
+    std::vector<uint16_t> image;
+    std::array<uint16_t, WORDS> window{};
+  };
+
+  std::shared_ptr<const Base> base{empty()};
+  std::array<const uint16_t *, CHUNKS> pages{};
+  // Chunks with a private copy, which may be written through pages.
+  uint64_t owned{0};
+  uint16_t *flat{nullptr};
+  std::array<uint8_t, LINES / 8> dirty{};
+  bool hashing{false};
+  uint64_t hash{0};
+
+  static const std::shared_ptr<const Base> &empty() {
+    static const auto nothing = std::make_shared<const Base>();
+    return nothing;
+  }
+
+  static constexpr uint64_t word_hash(int i, uint16_t value) {
+    return Memory::mix(static_cast<uint64_t>(i) << 16 | value);
+  }
+
+  void rehash() {
+    hash = 0;
+    for (int i = 0; i < WORDS; i++) {
+      hash ^= word_hash(i, pages[i / CHUNK_WORDS][i % CHUNK_WORDS]);
+    }
+  }
+
+  uint16_t original(uint16_t address) const {
+    return address < base->image.size() ? base->image[address] : 0;
+  }
+
+  void share() {
+    for (int chunk = 0; chunk < CHUNKS; chunk++) {
+      pages[chunk] = base->window.data() + chunk * CHUNK_WORDS;
+    }
+  }
+
+  // Drops every private copy and goes back to sharing the base.
+  void release() {
+    if (flat != nullptr) {
+      delete[] flat;
+      flat = nullptr;
+    } else {
+      for (int chunk = 0; chunk < CHUNKS; chunk++) {
+        if ((owned >> chunk & 1) != 0) {
+          delete[] pages[chunk];
+        }
+      }
+    }
+    owned = 0;
+    share();
+  }
+
+  void own(int chunk) {
+    auto *copy = new uint16_t[CHUNK_WORDS];
+    std::copy(pages[chunk], pages[chunk] + CHUNK_WORDS, copy);
+    pages[chunk] = copy;
+    owned |= 1ULL << chunk;
+  }
+
+  // Copies only the chunks which differ from the base.
+  void copy(const Memory &other) {
+    base = other.base;
+    dirty = other.dirty;
+    hashing = other.hashing;
+    hash = other.hash;
+    share();
+    for (int chunk = 0; chunk < CHUNKS; chunk++) {
+      if ((other.owned >> chunk & 1) != 0 &&
+          !std::equal(other.pages[chunk], other.pages[chunk] + CHUNK_WORDS,
+                      pages[chunk])) {
+        pages[chunk] = other.pages[chunk];
+        own(chunk);
+      }
+    }
+  }
+
+  // Leaves other sharing the base with nothing of its own.
+  void take(Memory &other) {
+    base = other.base;
+    pages = other.pages;
+    owned = other.owned;
+    flat = other.flat;
+    dirty = other.dirty;
+    hashing = other.hashing;
+    hash = other.hash;
+    other.owned = 0;
+    other.flat = nullptr;
+    other.share();
+  }
 
 public:
-  constexpr Memory() = default;
+  Memory() { share(); }
+  Memory(const Memory &other) { copy(other); }
+  Memory(Memory &&other) noexcept { take(other); }
+  Memory &operator=(const Memory &other) {
+    if (this != &other) {
+      release();
+      copy(other);
+    }
+    return *this;
+  }
+  Memory &operator=(Memory &&other) noexcept {
+    if (this != &other) {
+      release();
+      take(other);
+    }
+    return *this;
+  }
+  ~Memory() { release(); }
+
+  static constexpr bool addressable(uint16_t X) {
+    return static_cast<uint16_t>(X + 0x0800) < 0x1000;
+  }
+
+  static constexpr uint16_t index(uint16_t X) { return X & 0x0FFF; }
+
+  // The address the word at index i came from.
+  static constexpr uint16_t address(int i) {
+    return static_cast<uint16_t>(i < 0x0800 ? i : i | 0xF000);
+  }
+
+  // A 64-bit finaliser (SplitMix64's), good enough to hash machine states
+  // with.
+  static constexpr uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+  }
+
+  // Where the dirty bit for word X lives, as a byte of dirty_lines() and a
+  // mask within it.
+  static constexpr uint16_t dirty_byte(uint16_t X) {
+    return index(X) / LINE_WORDS / 8;
+  }
+  static constexpr uint8_t dirty_bit(uint16_t X) {
+    return static_cast<uint8_t>(1U << (index(X) / LINE_WORDS % 8));
+  }
+
+  // X must be addressable, as every operand is.
+  uint16_t operator()(uint16_t X) const {
+    return pages[index(X) / CHUNK_WORDS][index(X) % CHUNK_WORDS];
+  }
+
+  void store(uint16_t X, uint16_t value) {
+    const int chunk = index(X) / CHUNK_WORDS;
+    if ((owned >> chunk & 1) == 0) {
+      own(chunk);
+    }
+    // Owned chunks are never part of the base.
+    uint16_t &word =
+        const_cast<uint16_t *>(pages[chunk])[index(X) % CHUNK_WORDS];
+    if (hashing) {
+      hash ^= word_hash(index(X), word) ^ word_hash(index(X), value);
+    }
+    word = value;
+    mark(X);
+  }
+
+  void mark(uint16_t X) { dirty[dirty_byte(X)] |= dirty_bit(X); }
+
+  static constexpr uint64_t chunk_bit(uint16_t X) {
+    return 1ULL << (index(X) / CHUNK_WORDS);
+  }
+
+  // Marks every line of the chunks in a mask of chunk_bit()s.
+  void wrote(uint64_t chunks) {
+    static_assert(CHUNK_WORDS == 2 * LINE_WORDS);
+    for (; chunks != 0; chunks &= chunks - 1) {
+      const int chunk = __builtin_ctzll(chunks);
+      dirty[chunk / 4] |= static_cast<uint8_t>(3U << (chunk % 4 * 2));
+    }
+  }
+
+  // The instruction at any address.
+  uint16_t fetch(uint16_t address) const {
+    return addressable(address) ? (*this)(address) : original(address);
+  }
+
+  void load(const std::vector<uint16_t> &contents) {
+    auto loaded = std::make_shared<Base>();
+    loaded->image = contents;
+    for (int i = 0; i < WORDS; i++) {
+      loaded->window[i] =
+          address(i) < contents.size() ? contents[address(i)] : 0;
+    }
+
+    release();
+    base = std::move(loaded);
+    share();
+    dirty.fill(0);
+    if (hashing) {
+      rehash();
+    }
+  }
+
+  // Like load(), but with the window then set to words (laid out as data()
+  // has it). Lines which differ from the image are marked dirty.
+  void load(const std::vector<uint16_t> &contents, const uint16_t *words) {
+    load(contents);
+    for (int i = 0; i < WORDS; i++) {
+      if (base->window[i] != words[i]) {
+        store(address(i), words[i]);
+      }
+    }
+  }
+
+  // The image given to load().
+  const std::vector<uint16_t> &contents() const { return base->image; }
+
+  // The window, laid out as data() has it.
+  std::array<uint16_t, WORDS> words() const {
+    std::array<uint16_t, WORDS> result{};
+    for (int chunk = 0; chunk < CHUNKS; chunk++) {
+      std::copy(pages[chunk], pages[chunk] + CHUNK_WORDS,
+                result.begin() + chunk * CHUNK_WORDS);
+    }
+    return result;
+  }
+
+  // Puts back every line written since the last load() or reset(), and
+  // calls changed(address) for each word that was put back.
+  template <typename Changed> void reset(Changed &&changed) {
+    if (flat == nullptr) {
+      release();
+    }
+    for (int line = 0; line < LINES; line++) {
+      if ((dirty[line / 8] & (1U << (line % 8))) == 0) {
+        continue;
+      }
+      for (int i = line * LINE_WORDS; i < (line + 1) * LINE_WORDS; i++) {
+        if (flat != nullptr) {
+          flat[i] = base->window[i];
+        }
+        changed(address(i));
+      }
+    }
+    dirty.fill(0);
+    if (hashing) {
+      rehash();
+    }
+  }
+
+  // The window as one private block of memory, laid out by index(), for
+  // code which addresses it directly. Stays valid until the next load() or
+  // copy.
+  uint16_t *data() {
+    if (flat == nullptr) {
+      auto *block = new uint16_t[WORDS];
+      for (int chunk = 0; chunk < CHUNKS; chunk++) {
+        std::copy(pages[chunk], pages[chunk] + CHUNK_WORDS,
+                  block + chunk * CHUNK_WORDS);
+      }
+      release();
+      flat = block;
+      for (int chunk = 0; chunk < CHUNKS; chunk++) {
+        pages[chunk] = flat + chunk * CHUNK_WORDS;
+      }
+      owned = ALL_CHUNKS;
+    }
+    return flat;
+  }
+
+  uint8_t *dirty_lines() { return dirty.data(); }
+
+  // Starts (or stops) keeping digest() up to date. Writes made through
+  // data() are only seen if they're passed to stored() as well.
+  void keep_digest(bool enable) {
+    if (enable && !hashing) {
+      rehash();
+    }
+    hashing = enable;
+  }
 
-  constexpr uint16_t &operator()(uint16_t X) { return memory[X]; }
+  bool digesting() const { return hashing; }
+
+  // Brings digest() up to date with a write of value over previous at X.
+  void stored(uint16_t X, uint16_t previous, uint16_t value) {
+    hash ^= word_hash(index(X), previous) ^ word_hash(index(X), value);
+  }
+
+  uint64_t digest() const { return hash; }
 };
 
 struct ConditionCode {
@@ -24,9 +344,110 @@ struct ConditionCode {
   constexpr ConditionCode() = default;
   constexpr ConditionCode(uint16_t con, uint16_t r)
       : GT{con > r}, EQ{con == r}, LT{con < r} {}
+  constexpr ConditionCode(bool gt, bool eq, bool lt)
+      : GT{gt}, EQ{eq}, LT{lt} {}
+};
+
+// The condition codes as left by the last COMPARE, kept as the (widened)
+// difference of its operands so that COMPARE is a single subtraction and
+// each conditional jump only tests the one code it needs. NONE stands for
+// "no COMPARE has happened yet", where every code reads as false.
+class LazyConditionCode {
+  static constexpr uint32_t NONE{0x7FFFFFFF};
+
+  uint32_t difference{NONE};
+
+public:
+  constexpr LazyConditionCode() = default;
+  constexpr explicit LazyConditionCode(uint32_t bits) : difference{bits} {}
+  constexpr explicit LazyConditionCode(ConditionCode codes)
+      : difference{codes.GT   ? 1U
+                   : codes.EQ ? 0U
+                   : codes.LT ? static_cast<uint32_t>(-1)
+                              : NONE} {}
+
+  constexpr void compare(uint16_t con, uint16_t r) {
+    difference = static_cast<uint32_t>(con) - static_cast<uint32_t>(r);
+  }
+
+  constexpr uint32_t bits() const { return difference; }
+
+  constexpr bool GT() const { return difference - 1U < 0xFFFFU; }
+  constexpr bool EQ() const { return difference == 0U; }
+  constexpr bool LT() const { return difference + 0xFFFFU < 0xFFFFU; }
+
+  constexpr ConditionCode materialise() const {
+    return ConditionCode(GT(), EQ(), LT());
+  }
+};
+
+// An instruction decoded ahead of time: the opcode is kept as its top
+// nibble so it can index a dispatch table directly, and the 12-bit operand
+// is already sign-extended into an address.
+struct MicroOp {
+  uint8_t opcode{0};
+  uint16_t operand{0};
+
+  constexpr MicroOp() = default;
+  constexpr explicit MicroOp(uint16_t instruction)
+      : opcode{static_cast<uint8_t>(instruction >> 12)},
+        operand{decode_operand(instruction)} {}
+
+  static constexpr uint16_t decode_operand(uint16_t instruction) {
+    return static_cast<int16_t>(
+               static_cast<int16_t>(instruction & 0x0FFF) << 4) >>
+           4;
+  }
+};
+
+// A value read by an IN or written by an OUT, and the index (counting from
+// 0) of the instruction which did it. The same whatever the simulator's
+// observer, so that a recording can be replayed by any of them.
+struct IoEvent {
+  uint64_t instruction;
+  int16_t value;
+  bool output;
+};
+
+// An instruction which read a word before anything gave it a value, found
+// while sanitizing: where it is, what it was and the address it read.
+struct UninitializedRead {
+  uint16_t at;
+  uint16_t instruction;
+  uint16_t word;
+};
+
+// The hooks run() calls as it executes a program, all of which do nothing
+// here. An observer overrides whichever it needs (hiding them is enough,
+// since they're called on the concrete type) and is passed to
+// BasicSimulator, whose run() then calls it inline; with this one every
+// call compiles away. Simulators with any other observer run everything
+// through run(), without loop acceleration, so that no instruction goes
+// unseen.
+struct NullObserver {
+  // Before each instruction is executed.
+  void instruction(uint16_t /*address*/, uint16_t /*instruction*/) {}
+  // Each word an instruction reads or writes, with its value.
+  void read(uint16_t /*address*/, uint16_t /*value*/) {}
+  void write(uint16_t /*address*/, uint16_t /*value*/) {}
+  // Each jump taken.
+  void branch(uint16_t /*from*/, uint16_t /*to*/) {}
+  void input(uint16_t /*address*/, int16_t /*value*/) {}
+  void output(uint16_t /*address*/, int16_t /*value*/) {}
 };
 
-class Simulator {
+class Aot;
+class History;
+class Jit;
+
+template <typename Observer = NullObserver> class BasicSimulator {
+  friend class Aot;
+  friend class History;
+  friend class Jit;
+
+  static constexpr bool OBSERVED{!std::is_same_v<Observer, NullObserver>};
+
+public:
   enum OPCODE {
     LOAD = 0x0000,
     STORE = 0x1000,
@@ -48,136 +469,2167 @@ class Simulator {
 
   using Instruction = uint16_t;
 
+  // The addresses an infinite loop goes around, first to last.
+  struct Loop {
+    uint16_t first;
+    uint16_t last;
+  };
+
+  // Why run_threaded() stopped short: at a breakpoint, or at an instruction
+  // about to write a watched word. address is the breakpoint or the word.
+  struct Hit {
+    enum Kind : uint8_t {
+      BREAKPOINT,
+      WATCHPOINT,
+    };
+    Kind kind;
+    uint16_t address;
+  };
+
+  using IoEvent = ::IoEvent;
+  using UninitializedRead = ::UninitializedRead;
+
+  // Superinstructions the threaded engine can replace common sequences with
+  // when fusion is enabled. A fused micro-op takes the place of the first
+  // instruction of its sequence and reads the remaining operands from the
+  // micro-ops that follow it, which are left as they were, so jumping into
+  // the middle of a sequence still works.
+  enum Fusion : uint8_t {
+    COMPARE_JUMPGT,
+    COMPARE_JUMPEQ,
+    COMPARE_JUMPLT,
+    COMPARE_JUMPNEQ,
+    LOAD_ADD_STORE,
+    LOAD_SUBTRACT_STORE,
+    DECREMENT_LOAD_COMPARE_JUMPNEQ,
+    FUSIONS,
+  };
+
+  static constexpr const char *mnemonic(uint16_t instruction) {
+    constexpr const char *names[] = {
+        "LOAD",      "STORE",   "CLEAR",  "ADD",
+        "INCREMENT", "SUBTRACT", "DECREMENT", "COMPARE",
+        "JUMP",      "JUMPGT",  "JUMPEQ", "JUMPLT",
+        "JUMPNEQ",   "IN",      "OUT",    "HALT",
+    };
+    return names[instruction >> 12];
+  }
+
+  // A control-flow trace is a stream of words, each one of:
+  //  - up to 62 conditional jumps, a bit each (set if it was taken), first
+  //    jump highest, under a marker bit one above the last;
+  //  - TRACE_INPUT, with a value read in the low 16 bits;
+  //  - TRACE_END, with the instruction count in the low 62 bits, last.
+  // Together with the program, that's all it takes to work out every
+  // instruction the run executed.
+  static constexpr uint64_t TRACE_INPUT{2ULL << 62};
+  static constexpr uint64_t TRACE_END{3ULL << 62};
+
+  static constexpr const char *fusion_name(Fusion fusion) {
+    constexpr const char *names[] = {
+        "COMPARE; JUMPGT",
+        "COMPARE; JUMPEQ",
+        "COMPARE; JUMPLT",
+        "COMPARE; JUMPNEQ",
+        "LOAD; ADD; STORE",
+        "LOAD; SUBTRACT; STORE",
+        "DECREMENT; LOAD; COMPARE; JUMPNEQ",
+    };
+    return names[fusion];
+  }
+
 private:
+  // Fused micro-ops are numbered after the sixteen real opcodes.
+  static constexpr uint8_t FUSED{16};
+  // The threaded engine's program counter runs on into an entry with this
+  // opcode after the last address, so that falling off the end of memory
+  // back to 0 is handled as the backward jump it is.
+  static constexpr uint8_t WRAP{FUSED + FUSIONS};
+  // Decoded in place of any instruction at a breakpoint, or which writes a
+  // watched word, so that the threaded engine only stops to check on them
+  // where they apply.
+  static constexpr uint8_t TRAP{WRAP + 1};
+  // While tracing, conditional jumps are decoded as these instead (in the
+  // same order), which note which way they go before going there.
+  static constexpr uint8_t TRACED{TRAP + 1};
+  // While counting jumps, all five jumps are decoded as these instead (in
+  // the same order), which count the jump before taking it.
+  static constexpr uint8_t COUNTED{TRACED + 4};
+  // While sanitizing, every instruction but the jumps and HALT is decoded
+  // as one of these instead (by opcode), which checks the word it reads is
+  // initialized, or marks the word it writes as initialized, first.
+  static constexpr uint8_t CHECKED{COUNTED + 5};
+  // Every entry starts out as this, and is decoded the first time the
+  // threaded engine reaches it, so that a run only pays for decoding the
+  // instructions it executes.
+  static constexpr uint8_t DECODE{CHECKED + 16};
+  Observer watcher{};
   Memory CON{};
   uint16_t R{0};
   bool is_halted{false};
   uint16_t PC{0};
   ConditionCode codes{};
 
-  constexpr auto next_instruction() -> Instruction {
-    Instruction instr{CON(PC)};
-    increment_program_counter(PC + 1);
-    return instr;
+  // One entry per address (and the WRAP after them), so that the program
+  // counter can index it directly. Only allocated once the threaded engine
+  // runs, and kept up to date from then on until memory is written some
+  // other way. An entry's operand is only guaranteed once it has been
+  // decoded, or is part of a fused sequence. Copies of a simulator share it
+  // until one of them changes it (see decoding()), so copying one doesn't
+  // copy the table.
+  std::shared_ptr<std::vector<MicroOp>> decoded{};
+  bool predecoded{false};
+
+  // Breakpoint addresses and watched words (as memory indices). While any
+  // word is watched, every change to an instruction is re-decoded, since a
+  // new operand can make it write one. Having stopped at a trap,
+  // run_threaded() carries on by executing the instruction at resuming
+  // without stopping again.
+  std::set<uint16_t> breakpoints{};
+  std::set<uint16_t> watchpoints{};
+  uint16_t redecoded_bits{0xF000};
+  std::optional<Hit> trapped{};
+  int32_t resuming{-1};
+
+  bool fusing{false};
+  std::array<uint64_t, FUSIONS> fused{};
+
+  // The control-flow trace, handed to the sink a batch at a time. branches
+  // is the word being filled with jumps, holding just its marker bit when
+  // empty.
+  using TraceSink = std::function<void(const uint64_t *, std::size_t)>;
+  static constexpr std::size_t TRACE_BATCH{4096};
+  bool tracing{false};
+  TraceSink sink{};
+  std::vector<uint64_t> trail{};
+  uint64_t branches{1};
+
+  // How many times control has jumped from and to each address, while
+  // counting, and where it was when counting started.
+  bool counting{false};
+  std::vector<uint64_t> jumped_from{};
+  std::vector<uint64_t> jumped_to{};
+  uint16_t counted_from{0};
+
+  // While sanitizing, a bit for each word in the data window saying whether
+  // it's been given a value, and one for each address saying whether the
+  // instruction there has been found reading a word that hasn't, so that
+  // each is only noted once.
+  bool sanitizing{false};
+  std::array<uint64_t, Memory::WORDS / 64> initialized{};
+  std::vector<uint64_t> reported{};
+  std::vector<UninitializedRead> uninitialized{};
+
+  uint64_t executed{0};
+
+  // Pauses, the instruction budget and the deadline are all checked at
+  // backward jumps, and only once executed reaches due, the soonest any of
+  // them could need doing something. The clock is read every
+  // CLOCK_INTERVAL instructions. The engines make one comparison per
+  // backward jump, against stop_at, which is due unless the jump has to be
+  // looked at every time to accelerate loops or detect them, when it's 0.
+  using Clock = std::chrono::steady_clock;
+  static constexpr uint64_t NEVER{std::numeric_limits<uint64_t>::max()};
+  static constexpr uint64_t CLOCK_INTERVAL{1 << 20};
+  uint64_t pause{NEVER};
+  uint64_t budget{NEVER};
+  std::optional<Clock::time_point> deadline{};
+  uint64_t next_tick{NEVER};
+  uint64_t due{NEVER};
+  uint64_t stop_at{NEVER};
+  bool speeding{false};
+  bool spent{false};
+  bool late{false};
+
+  // Input handed over by feed(), and output kept by capture_output().
+  static constexpr std::size_t CAPTURE_RESERVE{4096};
+  bool feeding{false};
+  std::vector<int16_t> fed{};
+  std::size_t consumed{0};
+  bool capturing{false};
+  std::vector<int16_t> captured{};
+
+  // Kept for History, which can take the program back to before some of
+  // its I/O. Every value read goes in the journal, and replayed counts how
+  // many of them have been read on the way to where the program is now, so
+  // that the rest are read again from there. Output past written, up to
+  // shown, has been written once already and isn't written again.
+  bool journaling{false};
+  std::vector<int16_t> journal{};
+  std::size_t replayed{0};
+  uint64_t written{0};
+  uint64_t shown{0};
+
+  // I/O kept by record_io(), or checked against by replay_io(), in which
+  // case the next event due is at cursor. The engines only check at IN and
+  // OUT, and only while replaying.
+  bool recording{false};
+  bool replaying{false};
+  std::vector<IoEvent> events{};
+  std::size_t cursor{0};
+  std::optional<std::size_t> divergence{};
+
+  // Infinite loop detection. The state (memory, R, PC and the condition
+  // codes) is hashed at every backward jump and compared with one saved
+  // state, which is replaced after 1, 2, 4, 8... more backward jumps
+  // (Brent's cycle detection), so any loop is caught within a couple of
+  // trips around it for constant work per jump. A matching hash is checked
+  // word for word to rule out a collision. Seeing the same state twice
+  // without any input in between proves the program will never get out,
+  // and around covers every backward jump taken in between.
+  bool detecting{false};
+  bool recurrence{false};
+  uint64_t since_recurrence{0};
+  uint64_t recurrence_window{1};
+  uint64_t recurring{0};
+  uint16_t recurring_R{0};
+  uint16_t recurring_PC{0};
+  ConditionCode recurring_codes{};
+  std::vector<uint16_t> recurring_words{};
+  Loop around{};
+  std::optional<Loop> stuck{};
+
+  // Loop acceleration. After a loop fails to accelerate, the next
+  // backoff[edge] trips around it (by the jump at edge) aren't looked at
+  // again.
+  static constexpr uint16_t MAX_LOOP_LENGTH{64};
+  static constexpr int32_t MIN_ITERATIONS{8};
+  static constexpr uint16_t NOT_AFFINE{0xFFFF};
+  static constexpr uint16_t NEVER_EXITS{0x1000};
+  bool accelerating{false};
+  std::vector<uint16_t> backoff{};
+
+  // Where a word (or R) ends up after one trip around a loop, relative to
+  // the values at the top of the trip: the value of another location (or
+  // of nothing, for a constant) plus an offset.
+  static constexpr int32_t REGISTER{0x10000};
+  static constexpr int32_t CONSTANT{-1};
+  struct Affine {
+    int32_t base{CONSTANT};
+    uint16_t offset{0};
+  };
+
+  // How a COMPARE came out, as one bit each so that sets of them can be
+  // tested at once.
+  enum Relation : uint8_t {
+    BELOW = 1,
+    EQUAL = 2,
+    ABOVE = 4,
+  };
+
+  // Words past the end of the image read as zero, and run() fetches them
+  // from here, this many at a time.
+  static constexpr uint32_t ZEROS{256};
+  static constexpr std::array<uint16_t, ZEROS> NOTHING{};
+
+  // The run of words from address on that run() can fetch one after another
+  // without checking where they come from: the rest of the half of the
+  // window address is in, of the image between the halves, or of the zeros
+  // past the image. The instruction at any address in [address, end) is at
+  // that address less address in the block returned.
+  const uint16_t *fetching(const uint16_t *mem, uint32_t address,
+                           uint32_t &end) const {
+    if (address < 0x0800) {
+      end = 0x0800;
+      return mem + address;
+    }
+    if (address >= 0xF800) {
+      end = 0x10000;
+      return mem + Memory::index(static_cast<uint16_t>(address));
+    }
+    const auto &image = CON.contents();
+    if (address < image.size()) {
+      end = std::min<uint32_t>(static_cast<uint32_t>(image.size()), 0xF800);
+      return image.data() + address;
+    }
+    end = std::min<uint32_t>(address + ZEROS, 0xF800);
+    return NOTHING.data();
   }
 
-  constexpr void increment_program_counter(int16_t newPC) { PC = newPC; }
+  void forget_journal() {
+    journal.clear();
+    replayed = 0;
+    written = 0;
+    shown = 0;
+  }
 
-public:
-  constexpr Simulator() = default;
+  void reset_registers() {
+    R = 0;
+    PC = 0;
+    is_halted = false;
+    codes = ConditionCode();
+    executed = 0;
+    spent = false;
+    late = false;
+    schedule();
+    forget_states();
+    stuck.reset();
+    trapped.reset();
+    resuming = -1;
+    forget_journal();
+  }
 
-  constexpr void run() {
-    while (!halted()) {
-      const auto instruction = next_instruction();
+  // Snapshots are little-endian throughout, with runs of zero words
+  // squeezed out of the image and memory.
+  static constexpr char SNAPSHOT_MAGIC[4] = {'M', 'N', 'S', 'I'};
 
-      const uint16_t X = static_cast<int16_t>(
-                             static_cast<int16_t>(instruction & 0x0FFF) << 4) >>
-                         4;
+  template <typename T>
+  static void put(std::vector<uint8_t> &blob, T value) {
+    for (std::size_t i = 0; i < sizeof(T); i++) {
+      blob.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
 
-      switch (instruction & 0xF000) {
-      case LOAD: {
-        R = CON(X);
-        break;
-      }
-      case STORE: {
-        CON(X) = R;
-        break;
-      }
-      case CLEAR: {
-        CON(X) = 0;
-        break;
-      }
-      case ADD: {
-        R += CON(X);
-        break;
-      }
-      case INC: {
-        CON(X) += 1;
-        break;
-      }
-      case SUB: {
-        R -= CON(X);
-        break;
-      }
-      case DEC: {
-        CON(X) -= 1;
-        break;
+  template <typename T>
+  static bool get(const std::vector<uint8_t> &blob, std::size_t &at,
+                  T &value) {
+    if (blob.size() - at < sizeof(T)) {
+      return false;
+    }
+    value = 0;
+    for (std::size_t i = 0; i < sizeof(T); i++) {
+      value |= static_cast<T>(static_cast<T>(blob[at++]) << (8 * i));
+    }
+    return true;
+  }
+
+  // A word count, then pairs of (zeros to skip, words that follow).
+  static void put_words(std::vector<uint8_t> &blob, const uint16_t *words,
+                        uint32_t count) {
+    put(blob, count);
+    for (uint32_t i = 0; i < count;) {
+      uint16_t zeros = 0;
+      while (i < count && words[i] == 0 && zeros < 0xFFFF) {
+        ++zeros;
+        ++i;
       }
-      case COMP: {
-        codes = ConditionCode(CON(X), R);
-        break;
+      uint16_t literals = 0;
+      while (i + literals < count && words[i + literals] != 0 &&
+             literals < 0xFFFF) {
+        ++literals;
       }
-      case JUMP: {
-        increment_program_counter(X);
-        break;
+      put(blob, zeros);
+      put(blob, literals);
+      for (; literals != 0; --literals) {
+        put(blob, words[i++]);
       }
-      case JGT: {
-        if (!codes.GT) {
-          break;
-        }
+    }
+  }
 
-        increment_program_counter(X);
-        break;
+  static bool get_words(const std::vector<uint8_t> &blob, std::size_t &at,
+                        std::vector<uint16_t> &words, uint32_t limit) {
+    uint32_t count = 0;
+    if (!get(blob, at, count) || count > limit) {
+      return false;
+    }
+    words.assign(count, 0);
+    for (uint32_t i = 0; i < count;) {
+      uint16_t zeros = 0;
+      uint16_t literals = 0;
+      if (!get(blob, at, zeros) || !get(blob, at, literals) ||
+          count - i < static_cast<uint32_t>(zeros) + literals) {
+        return false;
       }
-      case JEQ: {
-        if (!codes.EQ) {
-          break;
+      i += zeros;
+      for (; literals != 0; --literals) {
+        if (!get(blob, at, words[i++])) {
+          return false;
         }
-
-        increment_program_counter(X);
-        break;
       }
-      case JLT: {
-        if (!codes.LT) {
-          break;
-        }
+    }
+    return true;
+  }
 
-        increment_program_counter(X);
-        break;
-      }
-      case JNEQ: {
-        if (codes.EQ) {
-          break;
-        }
+  static int16_t input() {
+    int16_t val{0};
+    std::cout << "(Input a number) => ";
 
-        increment_program_counter(X);
-        break;
-      }
-      case IN: {
-        int16_t val{0};
-        std::cout << "(Input a number) => ";
+    while (!(std::cin >> val)) {
+      std::cout << "(INVALID! Input a number) => ";
+      std::cin.clear();
+      std::cin.ignore();
+    }
 
-        while (!(std::cin >> val)) {
-          std::cout << "(INVALID! Input a number) => ";
-          std::cin.clear();
-          std::cin.ignore();
-        }
+    std::cin.ignore();
+    return val;
+  }
 
-        std::cin.ignore();
-        CON(X) = val;
+  static void output(uint16_t value) {
+    std::cout << "(Output        ) => " << static_cast<int16_t>(value) << '\n';
+  }
 
-        break;
-      }
-      case OUT: {
-        std::cout << "(Output        ) => " << static_cast<int16_t>(CON(X))
-                  << '\n';
-        break;
-      }
-      case HALT: {
-        is_halted = true;
-        break;
+  // Whether an IN can go ahead. A simulator which has been fed input never
+  // asks for more.
+  bool can_read() const {
+    return replayed < journal.size() || !feeding || consumed < fed.size();
+  }
+
+  int16_t read() {
+    if (replayed < journal.size()) {
+      return journal[replayed++];
+    }
+    const int16_t value = feeding ? fed[consumed++] : input();
+    if (journaling) {
+      journal.push_back(value);
+      ++replayed;
+    }
+    if (recording) {
+      events.push_back({executed - 1, value, false});
+    }
+    return value;
+  }
+
+  void emit(uint16_t value) {
+    if (journaling && ++written <= shown) {
+      return;
+    }
+    shown = written;
+    if (recording) {
+      events.push_back({executed - 1, static_cast<int16_t>(value), true});
+    }
+    if (capturing) {
+      captured.push_back(static_cast<int16_t>(value));
+    } else {
+      output(value);
+    }
+  }
+
+  void reschedule() {
+    due = std::min({pause, budget == NEVER ? NEVER : budget + 1, next_tick});
+    stop_at = speeding || detecting ? 0 : due;
+  }
+
+  void schedule() {
+    next_tick = deadline ? executed + CLOCK_INTERVAL : NEVER;
+    reschedule();
+  }
+
+  // Called at a backward jump once count reaches due. Returns whether to
+  // stop there.
+  bool interrupted(uint64_t count) {
+    if (count > budget) {
+      spent = true;
+      return true;
+    }
+    if (count >= pause) {
+      return true;
+    }
+    if (count >= next_tick) {
+      if (Clock::now() >= *deadline) {
+        late = true;
+        return true;
       }
+      next_tick = count + CLOCK_INTERVAL;
+    }
+    reschedule();
+    return false;
+  }
+
+  // Called at a backward jump (from edge to target) once an engine's count
+  // reaches stop_at, with R and executed brought up to date from it, either
+  // of which loop acceleration can move on. Returns whether to stop there.
+  bool stopping(uint16_t target, uint16_t edge, LazyConditionCode lazy) {
+    if (speeding) {
+      executed += accelerate(target, edge);
+    }
+    return (executed >= due && interrupted(executed)) ||
+           (detecting && repeats(target, edge, R, lazy.materialise()));
+  }
+
+  // While replaying, whether the IN or OUT (writing value) at the
+  // instruction index happens as the next event recorded. If it doesn't, the
+  // program has diverged there, and stays stopped before it.
+  bool expected(uint64_t index, bool output, uint16_t value) {
+    if (divergence) {
+      return false;
+    }
+    if (cursor < events.size() && events[cursor].instruction == index &&
+        events[cursor].output == output &&
+        (!output || events[cursor].value == static_cast<int16_t>(value))) {
+      ++cursor;
+      return true;
+    }
+    divergence = cursor;
+    return false;
+  }
+
+  // Whether the program has run out of instructions or time.
+  bool exhausted() const { return spent || late; }
+
+  void forget_states() {
+    recurrence = false;
+    since_recurrence = 0;
+    recurrence_window = 1;
+  }
+
+  // Called at each backward jump taken (from edge to target) while
+  // detecting loops. Returns whether the program is now known to be stuck.
+  bool repeats(uint16_t target, uint16_t edge, uint16_t r,
+               ConditionCode flags) {
+    // Bit 48 keeps the registers' hash apart from any word's.
+    const uint64_t state =
+        CON.digest() ^ Memory::mix(1ULL << 48 | r |
+                                   static_cast<uint64_t>(target) << 16 |
+                                   static_cast<uint64_t>(flags.GT) << 32 |
+                                   static_cast<uint64_t>(flags.EQ) << 33 |
+                                   static_cast<uint64_t>(flags.LT) << 34);
+
+    if (recurrence) {
+      around.first = std::min(around.first, target);
+      around.last = std::max(around.last, edge);
+      if (state == recurring && r == recurring_R && target == recurring_PC &&
+          flags.GT == recurring_codes.GT && flags.EQ == recurring_codes.EQ &&
+          flags.LT == recurring_codes.LT) {
+        const auto words = CON.words();
+        if (std::equal(words.begin(), words.end(), recurring_words.begin())) {
+          stuck = around;
+          return true;
+        }
       }
     }
+
+    if (++since_recurrence >= recurrence_window) {
+      recurrence = true;
+      since_recurrence = 0;
+      recurrence_window *= 2;
+      recurring = state;
+      recurring_R = r;
+      recurring_PC = target;
+      recurring_codes = flags;
+      const auto words = CON.words();
+      recurring_words.assign(words.begin(), words.end());
+      around = {target, target};
+    }
+    return false;
   }
 
-  constexpr bool halted() const { return is_halted; }
+  // The memory index of the word instruction writes, if it writes one.
+  static std::optional<uint16_t> written_word(uint16_t instruction) {
+    switch (instruction & 0xF000) {
+    case STORE:
+    case CLEAR:
+    case INC:
+    case DEC:
+    case IN:
+      return Memory::index(MicroOp::decode_operand(instruction));
+    default:
+      return std::nullopt;
+    }
+  }
 
-  constexpr void fill(std::array<uint16_t, 0xFFFF> contents) {
-    for (int i = 0; i < contents.size(); i++) {
-      CON(i) = contents[i];
+  // Whether instruction, decoded at X, would stop the threaded engine.
+  bool traps(uint16_t X, uint16_t instruction) const {
+    if (!breakpoints.empty() && breakpoints.count(X) != 0) {
+      return true;
+    }
+    if (watchpoints.empty()) {
+      return false;
     }
+    const auto word = written_word(instruction);
+    return word && watchpoints.count(*word) != 0;
   }
-};
+
+  // instruction as the threaded engine runs it, traps aside.
+  MicroOp decode_untrapped(uint16_t instruction) const {
+    MicroOp op{instruction};
+    if (counting && op.opcode >= (JUMP >> 12) && op.opcode <= (JNEQ >> 12)) {
+      op.opcode = static_cast<uint8_t>(COUNTED + op.opcode - (JUMP >> 12));
+    } else if (tracing && op.opcode >= (JGT >> 12) &&
+               op.opcode <= (JNEQ >> 12)) {
+      op.opcode = static_cast<uint8_t>(TRACED + op.opcode - (JGT >> 12));
+    }
+    if (sanitizing && (op.opcode < (JUMP >> 12) || op.opcode == (IN >> 12) ||
+                       op.opcode == (OUT >> 12))) {
+      op.opcode = static_cast<uint8_t>(CHECKED + op.opcode);
+    }
+    return op;
+  }
+
+  // The decoded table, to be changed, taken as a copy of its own first if
+  // it's shared with another simulator.
+  MicroOp *decoding() {
+    if (decoded.use_count() > 1) {
+      decoded = std::make_shared<std::vector<MicroOp>>(*decoded);
+    }
+    return decoded->data();
+  }
+
+  void decode(uint16_t X) {
+    const uint16_t instruction = CON.fetch(X);
+    MicroOp &op = decoding()[X];
+    op = decode_untrapped(instruction);
+    if (traps(X, instruction)) {
+      op.opcode = TRAP;
+    }
+  }
+
+  void trace(uint64_t word) {
+    trail.push_back(word);
+    if (trail.size() == TRACE_BATCH) {
+      sink(trail.data(), trail.size());
+      trail.clear();
+    }
+  }
+
+  void trace_branch(bool taken) {
+    branches = branches << 1 | static_cast<uint64_t>(taken);
+    if ((branches >> 62) != 0) {
+      trace(branches);
+      branches = 1;
+    }
+  }
+
+  // Notes the instruction at at as having read the word at X before it had
+  // a value, the first time it does. The threaded engine tests the word's
+  // bit itself, and only comes here when it isn't set.
+  __attribute__((noinline)) void read_uninitialized(uint16_t at,
+                                                    uint16_t X) {
+    if ((reported[at / 64] >> (at % 64) & 1) == 0) {
+      reported[at / 64] |= 1ULL << (at % 64);
+      uninitialized.push_back({at, CON.fetch(at), X});
+    }
+  }
+
+  void count_jump(uint16_t from, uint16_t to) {
+    ++jumped_from[from];
+    ++jumped_to[to];
+  }
+
+  // Input goes after the jumps before it.
+  void trace_input(int16_t value) {
+    if (branches != 1) {
+      trace(branches);
+      branches = 1;
+    }
+    trace(TRACE_INPUT | static_cast<uint16_t>(value));
+  }
+
+  void predecode() {
+    predecoded = true;
+    MicroOp undecoded{};
+    undecoded.opcode = DECODE;
+    if (decoded.use_count() != 1) {
+      decoded = std::make_shared<std::vector<MicroOp>>(0x10001, undecoded);
+    } else {
+      std::fill(decoded->begin(), decoded->end(), undecoded);
+    }
+    (*decoded)[0x10000].opcode = WRAP;
+  }
+
+  // Picks the micro-op opcode for address X, once it has been decoded,
+  // fusing it with the instructions after it when they form one of the
+  // recognised sequences. Sequences never run past the last address, nor
+  // over a trap. Nothing is fused while tracing or counting jumps, since
+  // fused jumps are neither traced nor counted, nor while sanitizing, since
+  // fused reads and writes aren't checked.
+  void fuse(uint16_t X) {
+    MicroOp *const table = decoding();
+    if (table[X].opcode == TRAP || table[X].opcode == DECODE || tracing ||
+        counting || sanitizing) {
+      return;
+    }
+    const auto at = [this, X](int offset) {
+      if (X + offset > 0xFFFF) {
+        return -1;
+      }
+      const auto Y = static_cast<uint16_t>(X + offset);
+      const uint16_t instruction = CON.fetch(Y);
+      return traps(Y, instruction) ? -1 : instruction & 0xF000;
+    };
+
+    uint8_t opcode = static_cast<uint8_t>(at(0) >> 12);
+    int length = 1;
+
+    if (at(0) == DEC && at(1) == LOAD && at(2) == COMP && at(3) == JNEQ) {
+      opcode = FUSED + DECREMENT_LOAD_COMPARE_JUMPNEQ;
+      length = 4;
+    } else if (at(0) == LOAD && at(1) == ADD && at(2) == STORE) {
+      opcode = FUSED + LOAD_ADD_STORE;
+      length = 3;
+    } else if (at(0) == LOAD && at(1) == SUB && at(2) == STORE) {
+      opcode = FUSED + LOAD_SUBTRACT_STORE;
+      length = 3;
+    } else if (at(0) == COMP) {
+      switch (at(1)) {
+      case JGT:
+        opcode = FUSED + COMPARE_JUMPGT;
+        length = 2;
+        break;
+      case JEQ:
+        opcode = FUSED + COMPARE_JUMPEQ;
+        length = 2;
+        break;
+      case JLT:
+        opcode = FUSED + COMPARE_JUMPLT;
+        length = 2;
+        break;
+      case JNEQ:
+        opcode = FUSED + COMPARE_JUMPNEQ;
+        length = 2;
+        break;
+      }
+    }
+
+    table[X].opcode = opcode;
+    // The fused handler reads the rest of the sequence's operands from the
+    // table, whether or not those instructions have been decoded yet.
+    for (int i = 1; i < length; i++) {
+      table[X + i].operand = MicroOp::decode_operand(
+          CON.fetch(static_cast<uint16_t>(X + i)));
+    }
+  }
+
+  // Every write made by the threaded engine goes through here, so that a
+  // program which stores into its own code has the word re-decoded before
+  // it can be executed. Fusion only looks at opcodes, so sequences around
+  // the word only need re-fusing when its opcode bits change (or any bits,
+  // while a word is watched).
+  void write(uint16_t X, uint16_t value) {
+    const uint16_t previous = CON(X);
+    CON.store(X, value);
+    redecode(X, previous, value);
+  }
+
+  // Brings decoded[X] up to date with a write of value over previous. The
+  // operand is all that usually changes, so that's done inline, and the
+  // rest only when the opcode (or a watched word) changes.
+  void redecode(uint16_t X, uint16_t previous, uint16_t value) {
+    decoding()[X].operand = MicroOp::decode_operand(value);
+
+    if (((previous ^ value) & redecoded_bits) != 0) {
+      decode_again(X);
+    }
+  }
+
+  // Decodes X again, along with every sequence it could be fused into.
+  __attribute__((noinline)) void decode_again(uint16_t X) {
+    decode(X);
+    if (fusing) {
+      for (int back = 0; back < 4; back++) {
+        fuse(static_cast<uint16_t>(X - back));
+      }
+    }
+  }
+
+  // Has X decoded again the next time it's reached, along with every
+  // sequence it could be fused into, rather than straight away.
+  void undecode(uint16_t X) {
+    MicroOp *const table = decoding();
+    for (int back = 0; back < 4; back++) {
+      table[static_cast<uint16_t>(X - back)].opcode = DECODE;
+    }
+  }
+
+  // Replaces memory with other, decoding only the words which differ
+  // again.
+  void replace_memory(const Memory &other) {
+    if (!predecoded) {
+      CON = other;
+      return;
+    }
+    const auto before = CON.words();
+    CON = other;
+    const auto after = CON.words();
+    for (int i = 0; i < Memory::WORDS; i++) {
+      if (before[i] != after[i]) {
+        redecode(Memory::address(i), before[i], after[i]);
+      }
+    }
+  }
+
+  // Decodes every instruction which writes the word at index again, once
+  // it starts or stops being watched.
+  void decode_writers(uint16_t index) {
+    for (int i = 0; i < 0x10000; i++) {
+      const auto X = static_cast<uint16_t>(i);
+      if (written_word(CON.fetch(X)) == index) {
+        decode_again(X);
+      }
+    }
+  }
+
+  // The first i >= 0 for which a + step * i (mod 2^16) lies in [lo, hi],
+  // or -1 if there isn't one. The sequence repeats after at most 2^16
+  // steps, and is walked one wraparound at a time rather than one step at a
+  // time.
+  static int32_t first_between(uint16_t a, uint16_t step, uint16_t lo,
+                               uint16_t hi) {
+    if (step > 0x8000) {
+      // Counting down is counting up in the mirror image.
+      return first_between(static_cast<uint16_t>(0xFFFF - a),
+                           static_cast<uint16_t>(-step),
+                           static_cast<uint16_t>(0xFFFF - hi),
+                           static_cast<uint16_t>(0xFFFF - lo));
+    }
+    if (step == 0) {
+      return lo <= a && a <= hi ? 0 : -1;
+    }
+
+    int64_t i = 0;
+    int64_t x = a;
+    while (i < 0x10000) {
+      if (lo <= x && x <= hi) {
+        return static_cast<int32_t>(i);
+      }
+      if (x < lo) {
+        const int64_t steps = (lo - x + step - 1) / step;
+        if (x + steps * step <= 0xFFFF) {
+          i += steps;
+          x += steps * step;
+          continue;
+        }
+      }
+      const int64_t steps = (0x10000 - x + step - 1) / step;
+      i += steps;
+      x += steps * step - 0x10000;
+    }
+    return -1;
+  }
+
+  // The first trip on which the comparison of CON(X) = x + x_step * i
+  // against R = r + r_step * i comes out as one of the relations in
+  // exits, or -1 if it can't be worked out (or never happens).
+  static int32_t first_exit(uint16_t x, uint16_t x_step, uint16_t r,
+                            uint16_t r_step, uint8_t exits) {
+    int32_t first = -1;
+    const auto earliest = [&first](int32_t i) {
+      if (i >= 0 && (first < 0 || i < first)) {
+        first = i;
+      }
+    };
+
+    if (r_step == 0 || x_step == 0) {
+      // One side stays put, so each relation holds for a range of the other.
+      const bool moving_x = r_step == 0;
+      const uint16_t start = moving_x ? x : r;
+      const uint16_t step = moving_x ? x_step : r_step;
+      const uint16_t fixed = moving_x ? r : x;
+      const uint8_t below = moving_x ? BELOW : ABOVE;
+      const uint8_t above = moving_x ? ABOVE : BELOW;
+
+      if ((exits & below) != 0 && fixed != 0) {
+        earliest(first_between(start, step, 0, fixed - 1));
+      }
+      if ((exits & EQUAL) != 0) {
+        earliest(first_between(start, step, fixed, fixed));
+      }
+      if ((exits & above) != 0 && fixed != 0xFFFF) {
+        earliest(first_between(start, step, fixed + 1, 0xFFFF));
+      }
+      return first;
+    }
+
+    // Both move, so only equality (of their difference with zero) has a
+    // closed form.
+    const uint16_t difference = x - r;
+    const uint16_t step = x_step - r_step;
+    if (exits == EQUAL) {
+      return first_between(difference, step, 0, 0);
+    }
+    if (exits == (BELOW | ABOVE)) {
+      return first_between(difference, step, 1, 0xFFFF);
+    }
+    return -1;
+  }
+
+  // Called when the jump at edge has just gone back to header. If the loop
+  // between them is straight-line code with a single exit, no I/O, and
+  // only ever adds constants to the words (and R) it changes, the number of
+  // trips before it exits is worked out in closed form and all but the last
+  // are skipped (or fewer, if the run has to stop before then): memory and
+  // R are left as they would be at the top of the next trip. Returns how
+  // many instructions were skipped.
+  uint64_t accelerate(uint16_t header, uint16_t edge) {
+    if (backoff[edge] != 0) {
+      --backoff[edge];
+      return 0;
+    }
+
+    const MicroOp jump{CON.fetch(edge)};
+    if (jump.opcode < (JUMP >> 12) || jump.opcode > (JNEQ >> 12) ||
+        jump.operand != header) {
+      return 0;
+    }
+
+    const auto reject = [this, edge]() {
+      backoff[edge] = NOT_AFFINE;
+      return 0;
+    };
+
+    if (edge - header >= MAX_LOOP_LENGTH) {
+      return reject();
+    }
+
+    // The loop leaves either by the edge not being taken, or by the one
+    // conditional jump out of it when the edge is unconditional.
+    int32_t exit = jump.opcode == (JUMP >> 12) ? -1 : edge;
+    int32_t comparison = -1;
+    bool writes_r = false;
+    std::vector<uint16_t> writes;
+
+    for (uint16_t address = header; address != edge; ++address) {
+      const MicroOp op{CON.fetch(address)};
+      switch (op.opcode << 12) {
+      case LOAD:
+      case ADD:
+      case SUB:
+        writes_r = true;
+        break;
+      case STORE:
+      case CLEAR:
+      case INC:
+      case DEC:
+        if (static_cast<uint16_t>(op.operand - header) <= edge - header) {
+          return reject();
+        }
+        writes.push_back(op.operand);
+        break;
+      case COMP:
+        if (exit < 0 || exit == edge) {
+          comparison = address;
+        }
+        break;
+      case JGT:
+      case JEQ:
+      case JLT:
+      case JNEQ:
+        if (exit >= 0 ||
+            static_cast<uint16_t>(op.operand - header) <= edge - header) {
+          return reject();
+        }
+        exit = address;
+        break;
+      default:
+        return reject();
+      }
+    }
+
+    if (exit < 0 || comparison < 0) {
+      return reject();
+    }
+
+    const auto written = [&](int32_t location) {
+      return location == REGISTER
+                 ? writes_r
+                 : std::find(writes.begin(), writes.end(), location) !=
+                       writes.end();
+    };
+    const auto concrete = [this](int32_t location) {
+      return location == REGISTER ? R : CON(static_cast<uint16_t>(location));
+    };
+
+    // Run one trip symbolically. Anything the loop never changes is read as
+    // the constant it is.
+    std::map<int32_t, Affine> trip;
+    const auto value = [&](int32_t location) {
+      if (const auto found = trip.find(location); found != trip.end()) {
+        return found->second;
+      }
+      return written(location) ? Affine{location, 0}
+                               : Affine{CONSTANT, concrete(location)};
+    };
+
+    Affine compared_x;
+    Affine compared_r;
+
+    for (uint16_t address = header; address != edge; ++address) {
+      const MicroOp op{CON.fetch(address)};
+      const Affine r = value(REGISTER);
+      const Affine x = value(op.operand);
+
+      switch (op.opcode << 12) {
+      case LOAD:
+        trip[REGISTER] = x;
+        break;
+      case STORE:
+        trip[op.operand] = r;
+        break;
+      case CLEAR:
+        trip[op.operand] = Affine{};
+        break;
+      case ADD:
+        if (x.base != CONSTANT && r.base != CONSTANT) {
+          return reject();
+        }
+        trip[REGISTER] = Affine{x.base != CONSTANT ? x.base : r.base,
+                                static_cast<uint16_t>(r.offset + x.offset)};
+        break;
+      case INC:
+        trip[op.operand] = Affine{x.base, static_cast<uint16_t>(x.offset + 1)};
+        break;
+      case SUB:
+        if (x.base != CONSTANT) {
+          return reject();
+        }
+        trip[REGISTER] =
+            Affine{r.base, static_cast<uint16_t>(r.offset - x.offset)};
+        break;
+      case DEC:
+        trip[op.operand] = Affine{x.base, static_cast<uint16_t>(x.offset - 1)};
+        break;
+      case COMP:
+        if (address == comparison) {
+          compared_x = x;
+          compared_r = r;
+        }
+        break;
+      }
+    }
+
+    // A location which goes up by the same amount every trip is an
+    // induction variable; anything else it ends up as must come from one
+    // (or a constant) some number of trips back, through the others.
+    const auto step = [&](int32_t location) -> std::pair<bool, uint16_t> {
+      const Affine after = value(location);
+      return {after.base == location, after.offset};
+    };
+
+    struct Root {
+      Affine origin;
+      int32_t depth;
+    };
+    std::map<int32_t, Root> roots;
+    int32_t deepest = 0;
+
+    for (const auto &[location, after] : trip) {
+      Affine origin = after;
+      int32_t depth = 1;
+      if (after.base == location) {
+        origin.offset = 0;
+        depth = 0;
+      }
+      while (depth != 0 && origin.base != CONSTANT &&
+             origin.base != location && !step(origin.base).first) {
+        const Affine further = value(origin.base);
+        origin = Affine{further.base,
+                        static_cast<uint16_t>(origin.offset + further.offset)};
+        if (++depth > static_cast<int32_t>(trip.size())) {
+          return reject();
+        }
+      }
+      if (origin.base == location && depth != 0) {
+        return reject();
+      }
+      roots[location] = Root{origin, depth};
+      deepest = std::max(deepest, depth);
+    }
+
+    // The operands of the COMPARE on trip i, as a start and a step.
+    const auto linear = [&](Affine operand, uint16_t &start, uint16_t &by) {
+      if (operand.base == CONSTANT) {
+        start = operand.offset;
+        by = 0;
+        return true;
+      }
+      const auto [induction, offset] = step(operand.base);
+      start = static_cast<uint16_t>(concrete(operand.base) + operand.offset);
+      by = offset;
+      return induction;
+    };
+
+    uint16_t x = 0;
+    uint16_t x_step = 0;
+    uint16_t r = 0;
+    uint16_t r_step = 0;
+    if (!linear(compared_x, x, x_step) || !linear(compared_r, r, r_step)) {
+      return reject();
+    }
+
+    const MicroOp leave{CON.fetch(static_cast<uint16_t>(exit))};
+    uint8_t taken = 0;
+    switch (leave.opcode << 12) {
+    case JGT:
+      taken = ABOVE;
+      break;
+    case JEQ:
+      taken = EQUAL;
+      break;
+    case JLT:
+      taken = BELOW;
+      break;
+    case JNEQ:
+      taken = BELOW | ABOVE;
+      break;
+    }
+    const uint8_t exits =
+        exit == edge ? static_cast<uint8_t>(~taken & 7) : taken;
+
+    const int32_t trips = first_exit(x, x_step, r, r_step, exits);
+    if (trips < 0) {
+      backoff[edge] = NEVER_EXITS;
+      return 0;
+    }
+    // Only as many trips are skipped as it takes to reach due, so that a
+    // pause, the budget or the clock stops the program at the same backward
+    // jump as it would without acceleration.
+    const uint64_t length = edge - header + 1U;
+    uint64_t skipped = static_cast<uint64_t>(trips);
+    if (due != NEVER) {
+      skipped = std::min(skipped, due > executed
+                                      ? (due - executed + length - 1) / length
+                                      : 0);
+    }
+    if (skipped < MIN_ITERATIONS ||
+        skipped <= static_cast<uint64_t>(deepest)) {
+      return 0;
+    }
+
+    // Every value is worked out from the state at the top of this trip
+    // before any of them is changed.
+    std::vector<std::pair<int32_t, uint16_t>> results;
+    for (const auto &[location, root] : roots) {
+      uint16_t result = root.origin.offset;
+      if (root.origin.base != CONSTANT) {
+        const uint16_t by = step(root.origin.base).second;
+        result += concrete(root.origin.base) +
+                  static_cast<uint16_t>(by * static_cast<uint32_t>(
+                                                 skipped - root.depth));
+      }
+      results.emplace_back(location, result);
+    }
+
+    for (const auto &[location, result] : results) {
+      if (location == REGISTER) {
+        R = result;
+      } else if (predecoded) {
+        write(static_cast<uint16_t>(location), result);
+      } else {
+        CON.store(static_cast<uint16_t>(location), result);
+      }
+    }
+
+    return skipped * length;
+  }
+
+  // run(), with HASHING set while memory keeps a digest.
+  template <bool ONCE, bool HASHING> void switched() {
+    if (halted() || stuck || exhausted()) {
+      return;
+    }
+    // A single step keeps the threaded engine's decoding up to date, so
+    // that a debugger can step and carry on without it all being redone.
+    if constexpr (!ONCE) {
+      predecoded = false;
+    }
+    speeding = accelerating && !OBSERVED && !ONCE && !counting;
+    if (speeding) {
+      backoff.resize(0x10000);
+    }
+    reschedule();
+
+    // Memory as the observer sees it.
+    uint16_t *const mem = CON.data();
+    const auto peek = [this, mem](uint16_t X) {
+      const uint16_t value = mem[Memory::index(X)];
+      watcher.read(X, value);
+      return value;
+    };
+    uint64_t written{0};
+    const auto poke = [this, mem, &written](uint16_t X, uint16_t value) {
+      watcher.write(X, value);
+      uint16_t &word = mem[Memory::index(X)];
+      const uint16_t previous = word;
+      if constexpr (HASHING) {
+        CON.stored(X, previous, value);
+      }
+      word = value;
+      written |= Memory::chunk_bit(X);
+      if constexpr (ONCE) {
+        if (predecoded) {
+          redecode(X, previous, value);
+        }
+      }
+    };
+
+    LazyConditionCode lazy{codes};
+    uint32_t pc{PC};
+    uint16_t r{R};
+    uint64_t count{executed};
+    // stopping() is given copies of r and count, in R and executed, so
+    // their addresses are never taken and they can stay in registers.
+    const auto stops = [this, &r, &lazy, &count](uint16_t target,
+                                                  uint16_t edge)
+                           __attribute__((always_inline)) {
+      R = r;
+      executed = count;
+      const bool stop = stopping(target, edge, lazy);
+      r = R;
+      count = executed;
+      return stop;
+    };
+    // Instructions come from code, which holds those from first up to end.
+    // Where they come from is only worked out again once the program
+    // counter leaves it, by a jump or by running off its end.
+    uint32_t first{0};
+    uint32_t end{0};
+    const uint16_t *code{nullptr};
+
+    for (;;) {
+      if (pc - first >= end - first) {
+        // Falling off the last address back to the first is a backward
+        // jump.
+        if (pc == 0x10000) {
+          pc = 0;
+          if (counting) {
+            count_jump(0xFFFF, 0);
+          }
+          if (count >= stop_at && stops(0, 0xFFFF)) {
+            break;
+          }
+        }
+        first = pc;
+        code = fetching(mem, pc, end);
+      }
+
+      const auto at = static_cast<uint16_t>(pc);
+      const uint16_t instruction = code[pc - first];
+      ++pc;
+      ++count;
+      watcher.instruction(at, instruction);
+
+      const uint16_t X = MicroOp::decode_operand(instruction);
+      bool taken = false;
+
+      // The top nibble, rather than the instruction masked, so that the
+      // cases are dense enough to make a jump table.
+      switch (instruction >> 12) {
+      case LOAD >> 12: {
+        r = peek(X);
+        break;
+      }
+      case STORE >> 12: {
+        poke(X, r);
+        break;
+      }
+      case CLEAR >> 12: {
+        poke(X, 0);
+        break;
+      }
+      case ADD >> 12: {
+        r += peek(X);
+        break;
+      }
+      case INC >> 12: {
+        poke(X, peek(X) + 1);
+        break;
+      }
+      case SUB >> 12: {
+        r -= peek(X);
+        break;
+      }
+      case DEC >> 12: {
+        poke(X, peek(X) - 1);
+        break;
+      }
+      case COMP >> 12: {
+        lazy.compare(peek(X), r);
+        break;
+      }
+      case JUMP >> 12: {
+        taken = true;
+        break;
+      }
+      case JGT >> 12: {
+        taken = lazy.GT();
+        break;
+      }
+      case JEQ >> 12: {
+        taken = lazy.EQ();
+        break;
+      }
+      case JLT >> 12: {
+        taken = lazy.LT();
+        break;
+      }
+      case JNEQ >> 12: {
+        taken = !lazy.EQ();
+        break;
+      }
+      // I/O is recorded against executed, which is otherwise only brought
+      // up to date on the way out.
+      case IN >> 12: {
+        if (!can_read() || (replaying && !expected(count - 1, false, 0))) {
+          pc = at;
+          --count;
+          goto stopped;
+        }
+        executed = count;
+        const int16_t value = read();
+        watcher.input(X, value);
+        poke(X, static_cast<uint16_t>(value));
+        if (detecting) {
+          forget_states();
+        }
+        break;
+      }
+      case OUT >> 12: {
+        const uint16_t value = peek(X);
+        if (replaying && !expected(count - 1, true, value)) {
+          pc = at;
+          --count;
+          goto stopped;
+        }
+        executed = count;
+        watcher.output(X, static_cast<int16_t>(value));
+        emit(value);
+        break;
+      }
+      case HALT >> 12: {
+        is_halted = true;
+        goto stopped;
+      }
+      }
+
+      if (taken) {
+        if (counting) {
+          count_jump(at, X);
+        }
+        watcher.branch(at, X);
+        pc = X;
+      }
+      if constexpr (ONCE) {
+        if (pc == 0x10000 && counting) {
+          count_jump(0xFFFF, 0);
+        }
+        break;
+      }
+      if (taken && X <= at && count >= stop_at && stops(X, at)) {
+        break;
+      }
+    }
+
+  stopped:
+    PC = static_cast<uint16_t>(pc);
+    R = r;
+    codes = lazy.materialise();
+    executed = count;
+    CON.wrote(written);
+  }
+
+  // run_threaded(), with HASHING set while memory keeps a digest.
+  template <bool HASHING> void threaded() {
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+    static void *const handlers[] = {
+        &&load,           &&store,          &&clear,
+        &&add,            &&inc,            &&sub,
+        &&dec,            &&comp,           &&jump,
+        &&jgt,            &&jeq,            &&jlt,
+        &&jneq,           &&in,             &&out,
+        &&halt,           &&comp_jgt,       &&comp_jeq,
+        &&comp_jlt,       &&comp_jneq,      &&load_add_store,
+        &&load_sub_store, &&dec_load_comp_jneq, &&wrap,
+        &&trap,           &&traced_jgt,     &&traced_jeq,
+        &&traced_jlt,     &&traced_jneq,    &&counted_jump,
+        &&counted_jgt,    &&counted_jeq,    &&counted_jlt,
+        &&counted_jneq,   &&checked_load,   &&checked_store,
+        &&checked_clear,  &&checked_add,    &&checked_inc,
+        &&checked_sub,    &&checked_dec,    &&checked_comp,
+        &&jump,           &&jgt,            &&jeq,
+        &&jlt,            &&jneq,           &&checked_in,
+        &&checked_out,    &&halt,           &&decode,
+    };
+    static_assert(sizeof(handlers) / sizeof(*handlers) == DECODE + 1);
+
+#define DISPATCH()                                                             \
+  op = &table[pc++];                                                           \
+  ++count;                                                                     \
+  goto *handlers[op->opcode]
+#define NEXT(n) table[static_cast<uint16_t>(pc + (n))]
+#define MEMORY(X) mem[Memory::index(X)]
+// The sanitizer's bit for the word at X, and what to do if it isn't set.
+#define SHADOW(X) shadow[Memory::index(X) / 64]
+#define SHADOW_BIT(X) (1ULL << (Memory::index(X) % 64))
+#define CHECK(X)                                                               \
+  if ((SHADOW(X) & SHADOW_BIT(X)) == 0) {                                      \
+    read_uninitialized(static_cast<uint16_t>(pc - 1), X);                      \
+  }
+#define MARK(X) SHADOW(X) |= SHADOW_BIT(X)
+// Takes the jump at address edge. Going backwards, it looks for a loop to
+// accelerate and checks whether it's time to stop.
+#define TAKE(target, edge)                                                     \
+  do {                                                                         \
+    const uint16_t from = (edge);                                              \
+    pc = (target);                                                             \
+    if (pc <= from && count >= stop_at &&                                      \
+        stops(static_cast<uint16_t>(pc), from)) {                              \
+      goto paused;                                                             \
+    }                                                                          \
+  } while (false)
+
+    trapped.reset();
+    if (halted() || stuck || exhausted()) {
+      return;
+    }
+
+    if (!predecoded) {
+      predecode();
+    }
+    // Accelerated loops would skip over traps in them, leave jumps out of
+    // the trace and the counts, and reads and writes out of the sanitizer's
+    // checks.
+    speeding = accelerating && breakpoints.empty() && watchpoints.empty() &&
+               !tracing && !counting && !sanitizing;
+    if (speeding) {
+      backoff.resize(0x10000);
+    }
+    reschedule();
+    if (resuming != PC) {
+      resuming = -1;
+    }
+
+    // Every store goes through put(), so that a program which stores into
+    // its own code has it decoded again. The decoded table is held in a
+    // register rather than reloaded at every dispatch, as the stores to
+    // memory would otherwise make it.
+    uint16_t *const mem = CON.data();
+    MicroOp *const table = decoding();
+    uint64_t *const shadow = initialized.data();
+    const uint16_t watched_bits = redecoded_bits;
+    uint64_t written{0};
+    // As redecode(), but with everything it needs in registers.
+    const auto put = [this, mem, table, watched_bits, &written](
+                         uint16_t X, uint16_t value)
+                         __attribute__((always_inline)) {
+      uint16_t &word = MEMORY(X);
+      const uint16_t previous = word;
+      if constexpr (HASHING) {
+        CON.stored(X, previous, value);
+      }
+      word = value;
+      written |= Memory::chunk_bit(X);
+      table[X].operand = MicroOp::decode_operand(value);
+      if (((previous ^ value) & watched_bits) != 0) {
+        decode_again(X);
+      }
+    };
+
+    LazyConditionCode lazy{codes};
+    uint32_t pc{PC};
+    uint16_t r{R};
+    uint64_t count{executed};
+    const MicroOp *op{nullptr};
+    MicroOp stepped{};
+    const auto stops = [this, &r, &lazy, &count](uint16_t target,
+                                                  uint16_t edge)
+                           __attribute__((always_inline)) {
+      R = r;
+      executed = count;
+      const bool stop = stopping(target, edge, lazy);
+      r = R;
+      count = executed;
+      return stop;
+    };
+
+    DISPATCH();
+
+  load:
+    r = MEMORY(op->operand);
+    DISPATCH();
+  store:
+    put(op->operand, r);
+    DISPATCH();
+  clear:
+    put(op->operand, 0);
+    DISPATCH();
+  add:
+    r += MEMORY(op->operand);
+    DISPATCH();
+  inc:
+    put(op->operand, MEMORY(op->operand) + 1);
+    DISPATCH();
+  sub:
+    r -= MEMORY(op->operand);
+    DISPATCH();
+  dec:
+    put(op->operand, MEMORY(op->operand) - 1);
+    DISPATCH();
+  comp:
+    lazy.compare(MEMORY(op->operand), r);
+    DISPATCH();
+  jump:
+    TAKE(op->operand, pc - 1);
+    DISPATCH();
+  jgt:
+    if (lazy.GT()) {
+      TAKE(op->operand, pc - 1);
+    }
+    DISPATCH();
+  jeq:
+    if (lazy.EQ()) {
+      TAKE(op->operand, pc - 1);
+    }
+    DISPATCH();
+  jlt:
+    if (lazy.LT()) {
+      TAKE(op->operand, pc - 1);
+    }
+    DISPATCH();
+  jneq:
+    if (!lazy.EQ()) {
+      TAKE(op->operand, pc - 1);
+    }
+    DISPATCH();
+  // I/O is recorded against executed, which is otherwise only brought up
+  // to date on the way out.
+  in: {
+    if (!can_read() || (replaying && !expected(count - 1, false, 0))) {
+      --pc;
+      --count;
+      goto paused;
+    }
+    executed = count;
+    const int16_t value = read();
+    put(op->operand, value);
+    if (tracing) {
+      trace_input(value);
+    }
+    if (detecting) {
+      forget_states();
+    }
+    DISPATCH();
+  }
+  out:
+    if (replaying && !expected(count - 1, true, MEMORY(op->operand))) {
+      --pc;
+      --count;
+      goto paused;
+    }
+    executed = count;
+    emit(MEMORY(op->operand));
+    DISPATCH();
+  // In the fused handlers pc already points at the second instruction of
+  // the sequence.
+  comp_jgt:
+    ++fused[COMPARE_JUMPGT];
+    ++count;
+    lazy.compare(MEMORY(op->operand), r);
+    if (lazy.GT()) {
+      TAKE(NEXT(0).operand, pc);
+    } else {
+      ++pc;
+    }
+    DISPATCH();
+  comp_jeq:
+    ++fused[COMPARE_JUMPEQ];
+    ++count;
+    lazy.compare(MEMORY(op->operand), r);
+    if (lazy.EQ()) {
+      TAKE(NEXT(0).operand, pc);
+    } else {
+      ++pc;
+    }
+    DISPATCH();
+  comp_jlt:
+    ++fused[COMPARE_JUMPLT];
+    ++count;
+    lazy.compare(MEMORY(op->operand), r);
+    if (lazy.LT()) {
+      TAKE(NEXT(0).operand, pc);
+    } else {
+      ++pc;
+    }
+    DISPATCH();
+  comp_jneq:
+    ++fused[COMPARE_JUMPNEQ];
+    ++count;
+    lazy.compare(MEMORY(op->operand), r);
+    if (!lazy.EQ()) {
+      TAKE(NEXT(0).operand, pc);
+    } else {
+      ++pc;
+    }
+    DISPATCH();
+  load_add_store:
+    ++fused[LOAD_ADD_STORE];
+    count += 2;
+    r = MEMORY(op->operand) + MEMORY(NEXT(0).operand);
+    put(NEXT(1).operand, r);
+    pc += 2;
+    DISPATCH();
+  load_sub_store:
+    ++fused[LOAD_SUBTRACT_STORE];
+    count += 2;
+    r = MEMORY(op->operand) - MEMORY(NEXT(0).operand);
+    put(NEXT(1).operand, r);
+    pc += 2;
+    DISPATCH();
+  dec_load_comp_jneq: {
+    const uint16_t X = op->operand;
+    put(X, MEMORY(X) - 1);
+    // The DECREMENT rewrote part of the sequence itself, so carry on one
+    // instruction at a time.
+    if (static_cast<uint16_t>(X - (pc - 1)) < 4) {
+      DISPATCH();
+    }
+    ++fused[DECREMENT_LOAD_COMPARE_JUMPNEQ];
+    count += 3;
+    r = MEMORY(NEXT(0).operand);
+    lazy.compare(MEMORY(NEXT(1).operand), r);
+    if (!lazy.EQ()) {
+      TAKE(NEXT(2).operand, pc + 2);
+    } else {
+      pc += 3;
+    }
+    DISPATCH();
+  }
+  wrap:
+    --count;
+    if (counting) {
+      count_jump(0xFFFF, 0);
+    }
+    TAKE(0, 0xFFFF);
+    DISPATCH();
+  // Decodes the instruction the first time it's reached, along with any
+  // sequence it starts, and runs it as that.
+  decode:
+    decode_again(static_cast<uint16_t>(pc - 1));
+    goto *handlers[op->opcode];
+  // Stops before the instruction, or if it's the one stopped at last time,
+  // runs it as it would have been decoded.
+  trap: {
+    const auto at = static_cast<uint16_t>(pc - 1);
+    if (at != resuming) {
+      trapped = breakpoints.count(at) != 0
+                    ? Hit{Hit::BREAKPOINT, at}
+                    : Hit{Hit::WATCHPOINT, MicroOp(CON.fetch(at)).operand};
+      resuming = at;
+      --pc;
+      --count;
+      goto paused;
+    }
+    resuming = -1;
+    stepped = decode_untrapped(CON.fetch(at));
+    op = &stepped;
+    goto *handlers[stepped.opcode];
+  }
+  traced_jgt:
+    trace_branch(lazy.GT());
+    goto jgt;
+  traced_jeq:
+    trace_branch(lazy.EQ());
+    goto jeq;
+  traced_jlt:
+    trace_branch(lazy.LT());
+    goto jlt;
+  traced_jneq:
+    trace_branch(!lazy.EQ());
+    goto jneq;
+  // Conditional jumps are traced here too, when both are on.
+  counted_jump:
+    count_jump(static_cast<uint16_t>(pc - 1), op->operand);
+    goto jump;
+  counted_jgt:
+    if (tracing) {
+      trace_branch(lazy.GT());
+    }
+    if (lazy.GT()) {
+      count_jump(static_cast<uint16_t>(pc - 1), op->operand);
+    }
+    goto jgt;
+  counted_jeq:
+    if (tracing) {
+      trace_branch(lazy.EQ());
+    }
+    if (lazy.EQ()) {
+      count_jump(static_cast<uint16_t>(pc - 1), op->operand);
+    }
+    goto jeq;
+  counted_jlt:
+    if (tracing) {
+      trace_branch(lazy.LT());
+    }
+    if (lazy.LT()) {
+      count_jump(static_cast<uint16_t>(pc - 1), op->operand);
+    }
+    goto jlt;
+  counted_jneq:
+    if (tracing) {
+      trace_branch(!lazy.EQ());
+    }
+    if (!lazy.EQ()) {
+      count_jump(static_cast<uint16_t>(pc - 1), op->operand);
+    }
+    goto jneq;
+  // IN marks its word even when it goes on to wait for input, since it
+  // writes it as soon as it carries on.
+  checked_load:
+    CHECK(op->operand);
+    goto load;
+  checked_store:
+    MARK(op->operand);
+    goto store;
+  checked_clear:
+    MARK(op->operand);
+    goto clear;
+  checked_add:
+    CHECK(op->operand);
+    goto add;
+  checked_inc:
+    CHECK(op->operand);
+    MARK(op->operand);
+    goto inc;
+  checked_sub:
+    CHECK(op->operand);
+    goto sub;
+  checked_dec:
+    CHECK(op->operand);
+    MARK(op->operand);
+    goto dec;
+  checked_comp:
+    CHECK(op->operand);
+    goto comp;
+  checked_in:
+    MARK(op->operand);
+    goto in;
+  checked_out:
+    CHECK(op->operand);
+    goto out;
+  halt:
+    is_halted = true;
+  paused:
+    PC = static_cast<uint16_t>(pc);
+    R = r;
+    codes = lazy.materialise();
+    executed = count;
+    CON.wrote(written);
+
+#undef TAKE
+#undef MARK
+#undef CHECK
+#undef SHADOW_BIT
+#undef SHADOW
+#undef MEMORY
+#undef NEXT
+#undef DISPATCH
+#pragma GCC diagnostic pop
+#else
+    run();
+#endif
+  }
+
+
+public:
+  BasicSimulator() = default;
+
+  // With ONCE set, executes just the instruction at PC, if it can (the
+  // program hasn't halted, or isn't waiting for input), and returns. Loops
+  // aren't accelerated then, and none of the checks made at backward jumps
+  // are.
+  template <bool ONCE = false> void run() {
+    if (CON.digesting()) {
+      switched<ONCE, true>();
+    } else {
+      switched<ONCE, false>();
+    }
+  }
+
+  // Same semantics as run(), but each instruction is decoded once, the
+  // first time it's reached, and dispatched with computed gotos. Falls back
+  // to run() on compilers without labels-as-values.
+  void run_threaded() {
+    if constexpr (OBSERVED) {
+      run();
+    } else if (CON.digesting()) {
+      threaded<true>();
+    } else {
+      threaded<false>();
+    }
+  }
+
+  // Executes the one instruction at PC with run().
+  void step() { run<true>(); }
+
+  constexpr bool halted() const { return is_halted; }
+  constexpr uint16_t program_counter() const { return PC; }
+  constexpr uint16_t accumulator() const { return R; }
+
+  // For debuggers. Changing the registers or memory counts as input, as far
+  // as detecting infinite loops goes.
+  void set_program_counter(uint16_t address) {
+    PC = address;
+    forget_states();
+  }
+
+  void set_accumulator(uint16_t value) {
+    R = value;
+    forget_states();
+  }
+
+  uint16_t memory(uint16_t address) const { return CON.fetch(address); }
+
+  // Returns false for a word outside the window, which only holds the
+  // program image and can't be written.
+  bool set_memory(uint16_t address, uint16_t value) {
+    if (!Memory::addressable(address)) {
+      return false;
+    }
+    if (predecoded) {
+      write(address, value);
+    } else {
+      CON.store(address, value);
+    }
+    forget_states();
+    return true;
+  }
+
+  Observer &observer() { return watcher; }
+  const Observer &observer() const { return watcher; }
+
+  // Lets run_threaded() replace common instruction sequences with fused
+  // superinstructions. Takes effect from the next run_threaded().
+  constexpr void enable_fusion(bool enable = true) {
+    predecoded = predecoded && fusing == enable;
+    fusing = enable;
+  }
+
+  // Lets run() and run_threaded() fast-forward simple counting loops.
+  // Takes effect from the next run.
+  constexpr void enable_loop_acceleration(bool enable = true) {
+    accelerating = enable;
+  }
+
+  // Makes run() and run_threaded() return, unhalted, at the first backward
+  // jump taken once instructions() has reached count. They can be called
+  // again to carry on from there.
+  void pause_after(uint64_t count) {
+    pause = count;
+    schedule();
+  }
+
+  // Makes run() and run_threaded() stop for good at the first backward jump
+  // taken once more than count instructions have been executed, or once the
+  // deadline has passed, with the program out_of_budget() or out_of_time().
+  // Like pauses these are only checked at backward jumps, so a program can
+  // overrun by as much as it runs without jumping back.
+  void limit_instructions(uint64_t count) {
+    budget = count;
+    spent = false;
+    schedule();
+  }
+
+  void limit_time(std::optional<std::chrono::steady_clock::time_point> until) {
+    deadline = until;
+    late = false;
+    schedule();
+  }
+
+  bool out_of_budget() const { return executed > budget; }
+  bool out_of_time() const { return late; }
+
+  // How many instructions have been executed, counting those skipped by
+  // loop acceleration and each one in a superinstruction. Only kept by
+  // run() and run_threaded(), and carried across snapshots; budgets and
+  // grading are both based on it.
+  constexpr uint64_t instructions() const { return executed; }
+
+  // Gives the program values as its next input, instead of asking for it.
+  // Once everything fed has been read, run() and run_threaded() stop at the
+  // next IN with the program waiting_for_input(), and can carry on once it
+  // has been fed more.
+  void feed(const std::vector<int16_t> &values) {
+    if (consumed == fed.size()) {
+      fed.clear();
+      consumed = 0;
+    }
+    feeding = true;
+    fed.insert(fed.end(), values.begin(), values.end());
+  }
+
+  bool waiting_for_input() const {
+    return !is_halted && !can_read() && (CON.fetch(PC) & 0xF000) == IN;
+  }
+
+  // Keeps what the program outputs, for captured_output(), instead of
+  // printing it.
+  void capture_output(bool enable = true) {
+    capturing = enable;
+    if (enable) {
+      captured.reserve(CAPTURE_RESERVE);
+    }
+  }
+
+  const std::vector<int16_t> &captured_output() const { return captured; }
+
+  // Keeps every value the program reads or writes, for io_record(), with
+  // the instruction that did it.
+  void record_io(bool enable = true) { recording = enable; }
+
+  const std::vector<IoEvent> &io_record() const { return events; }
+
+  // Runs the program against a recording rather than a user. Its input is
+  // what was read in the recording, and every IN and OUT has to happen at
+  // the same instruction as one there, in order (an OUT writing the same
+  // value), or the program has diverged() from it. run() and run_threaded()
+  // then stop before the instruction where it did, and don't go any
+  // further. Any IN or OUT past the end of the recording diverges too.
+  void replay_io(std::vector<IoEvent> script) {
+    events = std::move(script);
+    cursor = 0;
+    divergence.reset();
+    replaying = true;
+    recording = false;
+    std::vector<int16_t> inputs;
+    for (const auto &event : events) {
+      if (!event.output) {
+        inputs.push_back(event.value);
+      }
+    }
+    feed(inputs);
+  }
+
+  // The index in the recording of the event which didn't happen.
+  const std::optional<std::size_t> &diverged() const { return divergence; }
+
+  // How many of the recording's events have happened so far.
+  std::size_t replayed_io() const { return cursor; }
+
+  // Makes run() and run_threaded() watch for the program going back to a
+  // state it has been in before with no input read since, and stop there
+  // for good. Takes effect from the next run.
+  void detect_loops(bool enable = true) {
+    detecting = enable;
+    CON.keep_digest(enable);
+    forget_states();
+    reschedule();
+  }
+
+  // Set once run() or run_threaded() has found the program to be stuck in
+  // an infinite loop.
+  const std::optional<Loop> &infinite_loop() const { return stuck; }
+
+  // Makes run_threaded() stop before executing the instruction at address,
+  // with hit() saying why. Calling it again carries on from there. Traps are
+  // decoded into the program, so a breakpoint costs nothing anywhere else,
+  // and run() ignores them. Setting or clearing one (or a watchpoint) only
+  // decodes the instructions it affects again. Loop acceleration is off
+  // while any are set.
+  void set_breakpoint(uint16_t address) {
+    if (breakpoints.insert(address).second && predecoded) {
+      decode_again(address);
+    }
+  }
+
+  void clear_breakpoint(uint16_t address) {
+    if (breakpoints.erase(address) != 0 && predecoded) {
+      decode_again(address);
+    }
+  }
+
+  // Makes run_threaded() stop before executing any instruction which writes
+  // the word at address, the same way as at a breakpoint.
+  void watch(uint16_t address) {
+    redecoded_bits = 0xFFFF;
+    if (watchpoints.insert(Memory::index(address)).second && predecoded) {
+      decode_writers(Memory::index(address));
+    }
+  }
+
+  void unwatch(uint16_t address) {
+    const bool watched = watchpoints.erase(Memory::index(address)) != 0;
+    redecoded_bits = watchpoints.empty() ? 0xF000 : 0xFFFF;
+    if (watched && predecoded) {
+      decode_writers(Memory::index(address));
+    }
+  }
+
+  // Makes run_threaded() keep a control-flow trace, handing it to sink as
+  // it goes, in batches of words. Fusion and loop acceleration are off
+  // while tracing. Takes effect from the next run_threaded().
+  void trace_control_flow(TraceSink to) {
+    sink = std::move(to);
+    tracing = true;
+    trail.reserve(TRACE_BATCH);
+    predecoded = false;
+  }
+
+  // Ends the trace where the program is now, and hands over the rest of
+  // it.
+  void finish_trace() {
+    if (!tracing) {
+      return;
+    }
+    if (branches != 1) {
+      trail.push_back(branches);
+      branches = 1;
+    }
+    trail.push_back(TRACE_END | executed);
+    sink(trail.data(), trail.size());
+    trail.clear();
+    tracing = false;
+    predecoded = false;
+  }
+
+  // Makes run() and run_threaded() count how many times control jumps from
+  // and to each address, falling off the last address back to the first
+  // included. That's once per basic block rather than per instruction, and
+  // it's enough to work out how many times each instruction ran: see
+  // executions(). Fusion and loop acceleration are off while counting.
+  // Takes effect from the next run.
+  void count_jumps() {
+    counting = true;
+    jumped_from.assign(0x10000, 0);
+    jumped_to.assign(0x10000, 0);
+    counted_from = PC;
+    predecoded = false;
+  }
+
+  // How many times each address has executed since count_jumps(). Each
+  // instruction runs as often as control reaches it, by a jump or by
+  // carrying on from the one before, less any time the program stopped
+  // there; run() and run_threaded() stopping and carrying on from the same
+  // place cancel out.
+  std::vector<uint64_t> executions() const {
+    std::vector<uint64_t> counts(0x10000);
+    if (!counting) {
+      return counts;
+    }
+    // Halted at the last address, the program counter has wrapped round
+    // to an instruction it never reached.
+    const bool stopped = !is_halted || PC != 0;
+    uint64_t carried = 0;
+    for (uint32_t at = 0; at < 0x10000; ++at) {
+      counts[at] = carried + jumped_to[at] + (at == counted_from) -
+                   (stopped && at == PC);
+      carried = counts[at] - jumped_from[at];
+    }
+    return counts;
+  }
+
+  // How many times the jump at each address has been taken since
+  // count_jumps().
+  const std::vector<uint64_t> &jumps_taken() const { return jumped_from; }
+
+  // Makes run_threaded() keep a bit for each word in the data window saying
+  // whether it's been given a value, and note each instruction that reads
+  // a word that hasn't. Words start out with a value if the image loaded by
+  // fill() has one for them, and are given one by STORE, CLEAR, IN,
+  // INCREMENT and DECREMENT. Reads are made by LOAD, ADD, SUBTRACT,
+  // COMPARE and OUT, and by INCREMENT and DECREMENT before they write.
+  // Fusion and loop acceleration are off while sanitizing, and run() doesn't
+  // check. Takes effect from the next run_threaded().
+  void sanitize() {
+    sanitizing = true;
+    const std::size_t size = CON.contents().size();
+    initialized.fill(0);
+    for (int i = 0; i < Memory::WORDS; ++i) {
+      if (Memory::address(i) < size) {
+        initialized[i / 64] |= 1ULL << (i % 64);
+      }
+    }
+    reported.assign(0x10000 / 64, 0);
+    uninitialized.clear();
+    predecoded = false;
+  }
+
+  // Each instruction found reading a word before it had a value since
+  // sanitize(), in the order they first did.
+  const std::vector<UninitializedRead> &uninitialized_reads() const {
+    return uninitialized;
+  }
+
+  // Set when the last run_threaded() stopped at a breakpoint or watchpoint.
+  const std::optional<Hit> &hit() const { return trapped; }
+
+  // How many times each superinstruction has executed.
+  constexpr const std::array<uint64_t, FUSIONS> &fusions() const {
+    return fused;
+  }
+
+  void fill(const std::vector<uint16_t> &image) {
+    CON.load(image);
+    predecoded = false;
+    reset_registers();
+  }
+
+  static constexpr uint16_t SNAPSHOT_VERSION{1};
+
+  // Everything needed to carry on running from where the simulator is now:
+  // the image, memory, registers, condition codes, whether it has halted
+  // and the instruction count. Settings (fusion, loop acceleration, pauses)
+  // aren't included.
+  std::vector<uint8_t> snapshot() const {
+    std::vector<uint8_t> blob(std::begin(SNAPSHOT_MAGIC),
+                              std::end(SNAPSHOT_MAGIC));
+    put(blob, SNAPSHOT_VERSION);
+    put(blob, R);
+    put(blob, PC);
+    put(blob, static_cast<uint8_t>(is_halted | codes.GT << 1 |
+                                   codes.EQ << 2 | codes.LT << 3));
+    put(blob, executed);
+
+    const auto image = CON.contents();
+    put_words(blob, image.data(), static_cast<uint32_t>(image.size()));
+    put_words(blob, CON.words().data(), Memory::WORDS);
+    return blob;
+  }
+
+  // Returns false, leaving the simulator as it was, if blob isn't a
+  // snapshot of this version.
+  bool restore(const std::vector<uint8_t> &blob) {
+    std::size_t at = sizeof(SNAPSHOT_MAGIC);
+    uint16_t version = 0;
+    uint16_t r = 0;
+    uint16_t pc = 0;
+    uint8_t flags = 0;
+    uint64_t count = 0;
+    std::vector<uint16_t> image;
+    std::vector<uint16_t> words;
+
+    if (blob.size() < at ||
+        !std::equal(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC),
+                    blob.begin()) ||
+        !get(blob, at, version) || version != SNAPSHOT_VERSION ||
+        !get(blob, at, r) || !get(blob, at, pc) || !get(blob, at, flags) ||
+        !get(blob, at, count) || !get_words(blob, at, image, 0xFFFF) ||
+        !get_words(blob, at, words, Memory::WORDS) ||
+        words.size() != Memory::WORDS || at != blob.size()) {
+      return false;
+    }
+
+    CON.load(image, words.data());
+    predecoded = false;
+    R = r;
+    PC = pc;
+    is_halted = (flags & 1) != 0;
+    codes = ConditionCode((flags & 2) != 0, (flags & 4) != 0, (flags & 8) != 0);
+    executed = count;
+    spent = false;
+    late = false;
+    schedule();
+    forget_states();
+    stuck.reset();
+    trapped.reset();
+    resuming = -1;
+    forget_journal();
+    return true;
+  }
+
+  // Puts the simulator back the way fill() left it, ready for another run.
+  // Only the memory written since then is copied back, so this costs in
+  // proportion to what the last run touched rather than to the size of
+  // memory. Input fed but not read, the output captured and the I/O
+  // recorded are dropped; a replay starts again from the beginning of its
+  // recording.
+  void reset() {
+    CON.reset([this](uint16_t X) {
+      if (predecoded) {
+        undecode(X);
+      }
+    });
+    reset_registers();
+    fed.clear();
+    consumed = 0;
+    captured.clear();
+    if (replaying) {
+      replay_io(std::move(events));
+    } else {
+      events.clear();
+    }
+  }
+};
+
+using Simulator = BasicSimulator<>;
 
 #endif // SIMULATOR_HPP
@@ -0,0 +1,214 @@
+#ifndef STATISTICS_HPP
+#define STATISTICS_HPP
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "simulator.hpp"
+
+// What a run did, worked out afterwards from the jumps the simulator
+// counted (see Simulator::count_jumps()), so the engine itself only counts
+// once per basic block. Instructions are put down to the opcode at their
+// address when the run stopped, which for a program that rewrites its own
+// code may not be what ran there.
+struct Statistics {
+  std::string program{};
+  uint64_t instructions{0};
+  std::array<uint64_t, 16> opcodes{};
+  // For JUMP to JUMPNEQ, in that order.
+  std::array<uint64_t, 5> taken{};
+  std::array<uint64_t, 5> not_taken{};
+  uint64_t inputs{0};
+  uint64_t outputs{0};
+  // Distinct words in the data window loaded, stored, or compared against.
+  uint64_t words{0};
+  double seconds{0};
+
+  double per_second() const {
+    return seconds > 0 ? static_cast<double>(instructions) / seconds : 0;
+  }
+
+  template <typename Engine>
+  static Statistics of(const Engine &sim, std::string program,
+                       double seconds) {
+    Statistics run;
+    run.program = std::move(program);
+    run.seconds = seconds;
+
+    const auto executions = sim.executions();
+    const auto &taken = sim.jumps_taken();
+    std::bitset<Memory::WORDS> touched;
+    for (uint32_t at = 0; at < 0x10000; ++at) {
+      const uint64_t count = executions[at];
+      if (count == 0) {
+        continue;
+      }
+      const MicroOp op{sim.memory(static_cast<uint16_t>(at))};
+      run.instructions += count;
+      run.opcodes[op.opcode] += count;
+      if (op.opcode >= (Engine::JUMP >> 12) &&
+          op.opcode <= (Engine::JNEQ >> 12)) {
+        const int jump = op.opcode - (Engine::JUMP >> 12);
+        run.taken[jump] += taken[at];
+        run.not_taken[jump] += count - taken[at];
+      } else if (op.opcode != (Engine::HALT >> 12)) {
+        touched.set(Memory::index(op.operand));
+      }
+    }
+    run.inputs = run.opcodes[Engine::IN >> 12];
+    run.outputs = run.opcodes[Engine::OUT >> 12];
+    run.words = touched.count();
+    return run;
+  }
+};
+
+namespace statistics {
+
+// A JSON string.
+inline std::string quoted(const std::string &text) {
+  std::string out = "\"";
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      constexpr char digits[] = "0123456789abcdef";
+      out += "\\u00";
+      out += digits[(c >> 4) & 0xF];
+      out += digits[c & 0xF];
+    } else {
+      out += c;
+    }
+  }
+  return out + '"';
+}
+
+// OpenMetrics label values only escape backslashes, quotes and newlines.
+inline std::string label(const std::string &text) {
+  std::string out = "\"";
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else {
+      out += c;
+    }
+  }
+  return out + '"';
+}
+
+} // namespace statistics
+
+// One JSON object per run, a line each.
+inline void write_json(const std::vector<Statistics> &runs,
+                       std::ostream &out) {
+  using statistics::quoted;
+  for (const auto &run : runs) {
+    out << "{\"program\":" << quoted(run.program)
+        << ",\"instructions\":" << run.instructions << ",\"opcodes\":{";
+    for (int i = 0; i < 16; ++i) {
+      out << (i == 0 ? "" : ",")
+          << quoted(Simulator::mnemonic(static_cast<uint16_t>(i << 12)))
+          << ':' << run.opcodes[i];
+    }
+    out << "},\"jumps\":{";
+    for (int i = 0; i < 5; ++i) {
+      out << (i == 0 ? "" : ",")
+          << quoted(Simulator::mnemonic(
+                 static_cast<uint16_t>(Simulator::JUMP + (i << 12))))
+          << ":{\"taken\":" << run.taken[i]
+          << ",\"not_taken\":" << run.not_taken[i] << '}';
+    }
+    out << "},\"inputs\":" << run.inputs << ",\"outputs\":" << run.outputs
+        << ",\"words_touched\":" << run.words
+        << ",\"wall_seconds\":" << run.seconds
+        << ",\"instructions_per_second\":" << run.per_second() << "}\n";
+  }
+}
+
+// The OpenMetrics text format, with every run's metrics labelled with its
+// program.
+inline void write_openmetrics(const std::vector<Statistics> &runs,
+                              std::ostream &out) {
+  using statistics::label;
+  const auto family = [&out](const char *name, const char *type,
+                             const char *help) {
+    out << "# TYPE " << name << ' ' << type << "\n# HELP " << name << ' '
+        << help << '\n';
+  };
+
+  family("si_instructions", "counter", "Instructions executed.");
+  for (const auto &run : runs) {
+    for (int i = 0; i < 16; ++i) {
+      out << "si_instructions_total{program=" << label(run.program)
+          << ",opcode="
+          << label(Simulator::mnemonic(static_cast<uint16_t>(i << 12)))
+          << "} " << run.opcodes[i] << '\n';
+    }
+  }
+  family("si_jumps", "counter", "Jumps executed, by whether they were taken.");
+  for (const auto &run : runs) {
+    for (int i = 0; i < 5; ++i) {
+      const auto opcode = label(Simulator::mnemonic(
+          static_cast<uint16_t>(Simulator::JUMP + (i << 12))));
+      out << "si_jumps_total{program=" << label(run.program)
+          << ",opcode=" << opcode << ",taken=\"true\"} " << run.taken[i]
+          << "\nsi_jumps_total{program=" << label(run.program)
+          << ",opcode=" << opcode << ",taken=\"false\"} " << run.not_taken[i]
+          << '\n';
+    }
+  }
+  family("si_inputs", "counter", "Values read by IN.");
+  for (const auto &run : runs) {
+    out << "si_inputs_total{program=" << label(run.program) << "} "
+        << run.inputs << '\n';
+  }
+  family("si_outputs", "counter", "Values written by OUT.");
+  for (const auto &run : runs) {
+    out << "si_outputs_total{program=" << label(run.program) << "} "
+        << run.outputs << '\n';
+  }
+  family("si_words_touched", "gauge",
+         "Distinct data words the program used.");
+  for (const auto &run : runs) {
+    out << "si_words_touched{program=" << label(run.program) << "} "
+        << run.words << '\n';
+  }
+  family("si_wall_seconds", "gauge", "How long the run took.");
+  for (const auto &run : runs) {
+    out << "si_wall_seconds{program=" << label(run.program) << "} "
+        << run.seconds << '\n';
+  }
+  family("si_instructions_per_second", "gauge",
+         "Instructions executed per second of the run.");
+  for (const auto &run : runs) {
+    out << "si_instructions_per_second{program=" << label(run.program)
+        << "} " << run.per_second() << '\n';
+  }
+  out << "# EOF\n";
+}
+
+// Writes the statistics to a file in the given format, json or
+// openmetrics. Returns whether it could.
+inline bool save_statistics(const std::vector<Statistics> &runs,
+                            const std::string &format,
+                            const std::filesystem::path &path) {
+  std::ofstream file(path, std::ios::trunc);
+  if (format == "openmetrics") {
+    write_openmetrics(runs, file);
+  } else {
+    write_json(runs, file);
+  }
+  return static_cast<bool>(file.flush());
+}
+
+#endif // STATISTICS_HPP
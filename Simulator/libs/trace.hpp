@@ -0,0 +1,308 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simulator.hpp"
+
+// A trace file is the magic and version, then the words of a
+// control-flow trace (see Simulator::TRACE_INPUT), little-endian.
+namespace trace {
+
+constexpr char MAGIC[4] = {'M', 'N', 'T', 'R'};
+constexpr uint16_t VERSION{1};
+
+} // namespace trace
+
+// Writes a control-flow trace to a file on a thread of its own. The
+// simulator's thread copies each batch into a ring buffer and carries on;
+// the writer drains it to disk. Each side only ever moves its own end of
+// the ring, so neither takes a lock, and the simulator only waits if it
+// gets a whole ring ahead.
+class TraceWriter {
+public:
+  explicit TraceWriter(const std::filesystem::path &path)
+      : file(path, std::ios::binary | std::ios::trunc), ring(RING_WORDS) {
+    file.write(trace::MAGIC, sizeof(trace::MAGIC));
+    const uint8_t version[] = {static_cast<uint8_t>(trace::VERSION),
+                               static_cast<uint8_t>(trace::VERSION >> 8)};
+    file.write(reinterpret_cast<const char *>(version), sizeof(version));
+    writer = std::thread([this] { drain(); });
+  }
+
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+
+  ~TraceWriter() { close(); }
+
+  // Called by the one thread producing the trace.
+  void write(const uint64_t *words, std::size_t count) {
+    std::size_t head = produced.load(std::memory_order_relaxed);
+    while (count != 0) {
+      const std::size_t room =
+          RING_WORDS - (head - consumed.load(std::memory_order_acquire));
+      if (room == 0) {
+        std::this_thread::yield();
+        continue;
+      }
+      const std::size_t at = head % RING_WORDS;
+      const std::size_t n = std::min({count, room, RING_WORDS - at});
+      std::copy(words, words + n, ring.begin() + static_cast<long>(at));
+      words += n;
+      count -= n;
+      head += n;
+      produced.store(head, std::memory_order_release);
+    }
+  }
+
+  // Waits for everything written to reach the file. Returns whether it
+  // all did.
+  bool close() {
+    if (writer.joinable()) {
+      done.store(true, std::memory_order_release);
+      writer.join();
+      file.flush();
+    }
+    return static_cast<bool>(file);
+  }
+
+private:
+  static constexpr std::size_t RING_WORDS{1 << 16};
+
+  std::ofstream file;
+  std::vector<uint64_t> ring;
+  std::atomic<std::size_t> produced{0};
+  std::atomic<std::size_t> consumed{0};
+  std::atomic<bool> done{false};
+  std::thread writer{};
+
+  void drain() {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(RING_WORDS * 8);
+    std::size_t tail = 0;
+    for (;;) {
+      const bool finishing = done.load(std::memory_order_acquire);
+      const std::size_t head = produced.load(std::memory_order_acquire);
+      if (head == tail) {
+        if (finishing) {
+          return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        continue;
+      }
+
+      bytes.clear();
+      for (; tail != head; ++tail) {
+        const uint64_t word = ring[tail % RING_WORDS];
+        for (int i = 0; i < 8; ++i) {
+          bytes.push_back(static_cast<uint8_t>(word >> (8 * i)));
+        }
+      }
+      consumed.store(tail, std::memory_order_release);
+      file.write(reinterpret_cast<const char *>(bytes.data()),
+                 static_cast<std::streamsize>(bytes.size()));
+    }
+  }
+};
+
+// Reads a control-flow trace file back, a jump or an input at a time.
+class TraceReader {
+public:
+  explicit TraceReader(const std::filesystem::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(file), {});
+    constexpr std::size_t HEADER{sizeof(trace::MAGIC) + 2};
+    valid = bytes.size() >= HEADER &&
+            std::equal(std::begin(trace::MAGIC), std::end(trace::MAGIC),
+                       bytes.begin()) &&
+            (bytes[4] | bytes[5] << 8) == trace::VERSION &&
+            (bytes.size() - HEADER) % 8 == 0;
+    at = HEADER;
+
+    // A finished trace ends with the instruction count; one cut short
+    // just stops.
+    if (valid && bytes.size() > HEADER) {
+      at = bytes.size() - 8;
+      const uint64_t last = word();
+      if ((last & Simulator::TRACE_END) == Simulator::TRACE_END) {
+        end = last & ~Simulator::TRACE_END;
+        bytes.resize(bytes.size() - 8);
+      }
+      at = HEADER;
+    }
+  }
+
+  explicit operator bool() const { return valid; }
+
+  // How many instructions the run executed, if the trace got to the end.
+  const std::optional<uint64_t> &instructions() const { return end; }
+
+  // Which way the next conditional jump went, or nothing if the trace has
+  // none due.
+  std::optional<bool> branch() {
+    if (branches == 1) {
+      if (at == bytes.size() || (peek() >> 63) != 0 || peek() < 2) {
+        return std::nullopt;
+      }
+      branches = word();
+    }
+    int marker = 63;
+    while ((branches >> marker & 1) == 0) {
+      --marker;
+    }
+    const uint64_t bit = 1ULL << (marker - 1);
+    const bool taken = (branches & bit) != 0;
+    branches = (branches & (bit - 1)) | bit;
+    return taken;
+  }
+
+  // The value the next IN read, or nothing if the trace has none due.
+  std::optional<int16_t> input() {
+    if (branches != 1 || at == bytes.size() ||
+        (peek() & Simulator::TRACE_END) != Simulator::TRACE_INPUT) {
+      return std::nullopt;
+    }
+    return static_cast<int16_t>(word() & 0xFFFF);
+  }
+
+private:
+  std::vector<uint8_t> bytes{};
+  bool valid{false};
+  std::size_t at{0};
+  std::optional<uint64_t> end{};
+  uint64_t branches{1};
+
+  uint64_t peek() const {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+      value |= static_cast<uint64_t>(bytes[at + i]) << (8 * i);
+    }
+    return value;
+  }
+
+  uint64_t word() {
+    const uint64_t value = peek();
+    at += 8;
+    return value;
+  }
+};
+
+// Works out every instruction a traced run of image executed, and prints
+// them one per line: the instruction count, the address, the instruction,
+// and which way a conditional jump went or what an IN read or an OUT
+// wrote. The program is run again one instruction at a time, with its
+// input from the trace, and each conditional jump has to go the way the
+// trace says. Returns false if the trace can't be read or doesn't fit the
+// program.
+inline bool expand_trace(const std::vector<uint16_t> &image,
+                         const std::filesystem::path &path,
+                         std::ostream &out) {
+  TraceReader reader(path);
+  if (!reader) {
+    std::cerr << "Couldn't read trace '" << path.string() << "'\n";
+    return false;
+  }
+  const auto mismatch = [&path](uint64_t instruction) {
+    std::cerr << "Trace '" << path.string()
+              << "' doesn't fit the program at instruction " << instruction
+              << '\n';
+    return false;
+  };
+
+  Simulator sim{};
+  sim.fill(image);
+  sim.capture_output();
+  sim.feed({});
+
+  // Lines are built up in text and written in large pieces, since there's
+  // one for every instruction.
+  std::string text;
+  const auto number = [&text](auto value, int base = 10, int width = 0) {
+    char digits[24];
+    const auto end = std::to_chars(digits, digits + sizeof(digits), value,
+                                   base)
+                         .ptr;
+    text.append(static_cast<std::size_t>(std::max<long>(
+                    0, width - (end - digits))),
+                '0');
+    text.append(digits, end);
+  };
+  const auto flush = [&out, &text] {
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    text.clear();
+  };
+
+  const auto &end = reader.instructions();
+  while (!sim.halted() && (!end || sim.instructions() < *end)) {
+    const uint16_t address = sim.program_counter();
+    const uint16_t instruction = sim.memory(address);
+    const uint16_t code = instruction & 0xF000;
+    const MicroOp op{instruction};
+
+    // Without an end, the run stops wherever the trace runs out.
+    std::optional<bool> taken;
+    if (code >= Simulator::JGT && code <= Simulator::JNEQ) {
+      taken = reader.branch();
+      if (!taken) {
+        flush();
+        return end ? mismatch(sim.instructions()) : true;
+      }
+    } else if (code == Simulator::IN) {
+      const auto value = reader.input();
+      if (!value) {
+        flush();
+        return end ? mismatch(sim.instructions()) : true;
+      }
+      sim.feed({*value});
+    }
+
+    number(sim.instructions());
+    text += ' ';
+    number(address, 16, 4);
+    text += ' ';
+    number(instruction, 16, 4);
+    text += ' ';
+    text += Simulator::mnemonic(instruction);
+    text += ' ';
+    number(op.operand, 16);
+    const std::size_t outputs = sim.captured_output().size();
+    sim.step();
+
+    if (taken) {
+      const uint16_t to =
+          *taken ? op.operand : static_cast<uint16_t>(address + 1);
+      if (sim.program_counter() != to) {
+        text += '\n';
+        flush();
+        return mismatch(sim.instructions() - 1);
+      }
+      text += *taken ? " taken" : " not taken";
+    } else if (code == Simulator::IN) {
+      text += " <- ";
+      number(static_cast<int16_t>(sim.memory(op.operand)));
+    } else if (sim.captured_output().size() != outputs) {
+      text += " -> ";
+      number(sim.captured_output().back());
+    }
+    text += '\n';
+    if (text.size() >= 1 << 16) {
+      flush();
+    }
+  }
+  flush();
+  return true;
+}
+
+#endif // TRACE_HPP
@@ -0,0 +1,65 @@
+// Checks that a program compiled ahead of time leaves memory and registers
+// exactly as run() does, that the compiled object is cached and used
+// again, and that a self-modifying program is left to the interpreter.
+// Compiled code reads and writes the terminal, so programs which read
+// input aren't run, and what they print isn't compared.
+
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "../libs/aot.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// A simulator with program loaded, printing its output as compiled code
+// does.
+Simulator printing(const Program &program) {
+  Simulator sim{};
+  sim.fill(program.image);
+  return sim;
+}
+
+// What run() leaves the program as, apart from its output.
+Outcome interpreted(const Program &program) {
+  Simulator sim = loaded(program);
+  sim.run();
+  auto run = Outcome::of(sim);
+  run.output.clear();
+  return run;
+}
+
+} // namespace
+
+auto main() -> int {
+  const auto cache = std::filesystem::temp_directory_path() /
+                     ("si-test-aot-" + std::to_string(getpid()));
+
+  check::subject = COUNT.name;
+  for (int run = 0; run < 2; ++run) {
+    Simulator compiled = printing(COUNT);
+    EXPECT(Aot(compiled, cache).run(COUNT.image));
+    EXPECT(Outcome::of(compiled) == interpreted(COUNT));
+  }
+  int objects = 0;
+  for (const auto &entry : std::filesystem::directory_iterator(cache)) {
+    objects += entry.path().extension() == ".so";
+  }
+  EXPECT(objects == 1);
+
+  check::subject = PATCH.name;
+  Simulator patched = printing(PATCH);
+  EXPECT(!Aot(patched, cache).run(PATCH.image));
+  EXPECT(patched.program_counter() == 0 && patched.instructions() == 0);
+  patched.run();
+  EXPECT(Outcome::of(patched) == interpreted(PATCH));
+
+  std::error_code error;
+  std::filesystem::remove_all(cache, error);
+  return check::status();
+}
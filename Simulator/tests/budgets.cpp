@@ -0,0 +1,88 @@
+// Checks that both engines, with and without loop acceleration, stop a
+// program at the first backward jump past its instruction budget or its
+// deadline, and that it can carry on from there given more.
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// Counts n down to zero, five instructions at a time.
+const Program DOWN = {"down",
+                      {
+                          0x0006, // 0: LOAD n
+                          0x5007, //    SUBTRACT one
+                          0x1006, //    STORE n
+                          0x7008, //    COMPARE zero
+                          0xC000, //    JUMPNEQ 0
+                          0xF000, // 5: HALT
+                          60000,  //    n
+                          1,      //    one
+                          0,      //    zero
+                      },
+                      {}};
+
+constexpr uint64_t DOWN_INSTRUCTIONS{60000 * 5 + 1};
+
+// Jumps to itself.
+const Program SELF = {"self", {0x8000}, {}};
+
+template <typename Run>
+void check_engine(const std::string &engine, Run &&run) {
+  for (const bool accelerating : {false, true}) {
+    check::subject = engine + (accelerating ? " accelerated" : "");
+
+    Simulator limited = loaded(DOWN);
+    limited.enable_loop_acceleration(accelerating);
+    limited.limit_instructions(1000);
+    run(limited);
+    EXPECT(limited.out_of_budget() && !limited.halted());
+    EXPECT(limited.instructions() > 1000 && limited.instructions() <= 1005);
+
+    // Given more, it carries on to the end as if it had never stopped.
+    limited.limit_instructions(std::numeric_limits<uint64_t>::max());
+    run(limited);
+    EXPECT(!limited.out_of_budget() && limited.halted());
+    EXPECT(limited.instructions() == DOWN_INSTRUCTIONS);
+    Simulator straight = loaded(DOWN);
+    run(straight);
+    EXPECT(Outcome::of(limited) == Outcome::of(straight));
+
+    Simulator enough = loaded(DOWN);
+    enough.enable_loop_acceleration(accelerating);
+    enough.limit_instructions(DOWN_INSTRUCTIONS);
+    run(enough);
+    EXPECT(!enough.out_of_budget() && enough.halted());
+
+    // The budget is only there so that missing the deadline fails rather
+    // than hangs.
+    Simulator late = loaded(SELF);
+    late.enable_loop_acceleration(accelerating);
+    late.limit_instructions(1ULL << 36);
+    const auto start = std::chrono::steady_clock::now();
+    late.limit_time(start + std::chrono::milliseconds(20));
+    run(late);
+    EXPECT(late.out_of_time() && !late.out_of_budget() && !late.halted());
+    EXPECT(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+    late.limit_time(std::nullopt);
+    late.limit_instructions(late.instructions() + 1000);
+    run(late);
+    EXPECT(!late.out_of_time() && late.out_of_budget());
+  }
+}
+
+} // namespace
+
+auto main() -> int {
+  check_engine("switch", [](Simulator &sim) { sim.run(); });
+  check_engine("threaded", [](Simulator &sim) { sim.run_threaded(); });
+  return check::status();
+}
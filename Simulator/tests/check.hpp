@@ -0,0 +1,35 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <iostream>
+#include <string>
+
+// Each test is a program which prints every EXPECT that fails, with where
+// it is and what it was checking at the time, and exits with status 1 if
+// any did.
+namespace check {
+
+inline int failures{0};
+
+// What the test is looking at, such as the program it's running, for
+// failures to say.
+inline std::string subject{};
+
+inline void fail(const char *file, int line, const char *condition) {
+  std::cerr << file << ':' << line << ": expected " << condition;
+  if (!subject.empty()) {
+    std::cerr << " (" << subject << ')';
+  }
+  std::cerr << '\n';
+  ++failures;
+}
+
+inline int status() { return failures == 0 ? 0 : 1; }
+
+} // namespace check
+
+#define EXPECT(condition)                                                      \
+  ((condition) ? static_cast<void>(0)                                          \
+               : check::fail(__FILE__, __LINE__, #condition))
+
+#endif // CHECK_HPP
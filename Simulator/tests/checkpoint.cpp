@@ -0,0 +1,92 @@
+// Checks that a program resumed from a checkpoint, taken at any backward
+// jump or while it waits for input, ends exactly as it would have run
+// straight through, that saving leaves nothing else behind, and that a
+// damaged checkpoint is refused without touching the simulator.
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "../libs/checkpoint.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+auto main() -> int {
+  const auto directory = std::filesystem::temp_directory_path() /
+                         ("si-test-checkpoint-" + std::to_string(getpid()));
+  std::filesystem::create_directories(directory);
+  const auto path = directory / "run.ckpt";
+
+  for (const auto &program : {COUNT, PATCH}) {
+    check::subject = program.name;
+
+    Simulator straight = loaded(program);
+    straight.run();
+
+    // Pauses only happen at backward jumps, so this resumes from each.
+    Simulator paused = loaded(program);
+    while (!paused.halted()) {
+      paused.pause_after(paused.instructions() + 1);
+      paused.run();
+      EXPECT(save_checkpoint(paused, path));
+
+      Simulator resumed = loaded(program);
+      EXPECT(load_checkpoint(resumed, path));
+      EXPECT(resumed.instructions() == paused.instructions());
+      resumed.run();
+      EXPECT(resumed.instructions() == straight.instructions());
+      // What was printed before the checkpoint isn't in it.
+      auto expected = Outcome::of(straight);
+      expected.output.erase(expected.output.begin(),
+                            expected.output.begin() +
+                                static_cast<long>(
+                                    paused.captured_output().size()));
+      EXPECT(Outcome::of(resumed) == expected);
+    }
+  }
+
+  // Input isn't in a checkpoint either: the resumed run is fed the rest.
+  check::subject = SUM.name;
+  Simulator straight = loaded(SUM);
+  straight.run();
+  Simulator waiting = loaded({SUM.name, SUM.image, {SUM.input[0]}});
+  waiting.run();
+  EXPECT(waiting.waiting_for_input());
+  EXPECT(save_checkpoint(waiting, path));
+  Simulator resumed = loaded({SUM.name, SUM.image, {}});
+  EXPECT(load_checkpoint(resumed, path));
+  resumed.feed({SUM.input.begin() + 1, SUM.input.end()});
+  resumed.run();
+  EXPECT(resumed.halted());
+  EXPECT(resumed.instructions() == straight.instructions());
+  EXPECT(resumed.memory(0xFFF0) == straight.memory(0xFFF0));
+
+  int files = 0;
+  for ([[maybe_unused]] const auto &entry :
+       std::filesystem::directory_iterator(directory)) {
+    ++files;
+  }
+  EXPECT(files == 1);
+
+  // Cut short, the checkpoint no longer restores, and the simulator is
+  // left as it was.
+  check::subject = "truncated";
+  const auto size = std::filesystem::file_size(path);
+  std::filesystem::resize_file(path, size - 1);
+  Simulator untouched = loaded(COUNT);
+  EXPECT(!load_checkpoint(untouched, path));
+  EXPECT(untouched.program_counter() == 0 && untouched.instructions() == 0);
+  EXPECT(!load_checkpoint(untouched, directory / "missing.ckpt"));
+  std::ofstream(path, std::ios::binary) << "MNSI";
+  EXPECT(!load_checkpoint(untouched, path));
+  untouched.run();
+  EXPECT(untouched.halted());
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return check::status();
+}
@@ -0,0 +1,103 @@
+// Checks that cost files are read as documented, that anything else in one
+// is refused, and that the cycles worked out from either engine's run add
+// up to each instruction stepped through at its opcode's cost.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "../libs/cost.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+bool parses(const std::filesystem::path &path, const std::string &text,
+            CostModel &model) {
+  std::ofstream(path) << text;
+  return load_costs(model, path);
+}
+
+// The cycles a run of program takes, stepping it one instruction at a
+// time.
+uint64_t stepped(const Program &program, const CostModel &model) {
+  uint64_t cycles = 0;
+  Simulator sim = loaded(program);
+  while (!sim.halted() && !sim.waiting_for_input()) {
+    cycles += model.cycles[sim.memory(sim.program_counter()) >> 12];
+    sim.step();
+  }
+  return cycles;
+}
+
+template <typename Run>
+void check_engine(const std::string &engine, Run &&run,
+                  const CostModel &model) {
+  for (const auto &program : PROGRAMS) {
+    check::subject = engine + ' ' + program.name;
+
+    Simulator sim = loaded(program);
+    sim.count_jumps();
+    run(sim);
+    const auto unit = Cycles::of(sim, CostModel{});
+    EXPECT(unit.total == sim.instructions());
+    const auto costed = Cycles::of(sim, model);
+    EXPECT(costed.total == stepped(program, model));
+  }
+
+  // The LOAD at 3 runs ten times, at four cycles each.
+  check::subject = engine + ' ' + COUNT.name;
+  Simulator count = loaded(COUNT);
+  count.count_jumps();
+  run(count);
+  EXPECT(Cycles::of(count, model).at[3] == 40);
+}
+
+} // namespace
+
+auto main() -> int {
+  const auto directory = std::filesystem::temp_directory_path() /
+                         ("si-test-costs-" + std::to_string(getpid()));
+  std::filesystem::create_directories(directory);
+  const auto path = directory / "run.cost";
+
+  check::subject = "example";
+  CostModel model;
+  EXPECT(parses(path,
+                "# Memory is slow.\n"
+                "\n"
+                "LOAD 4\n"
+                "  STORE\t4   # and so is this\n"
+                "JUMP 1\n"
+                "OUT 100\n",
+                model));
+  for (int opcode = 0; opcode < 16; ++opcode) {
+    const uint64_t expected = opcode == 0 || opcode == 1 ? 4
+                              : opcode == 14             ? 100
+                                                         : 1;
+    EXPECT(model.cycles[opcode] == expected);
+  }
+
+  for (const char *text : {"FETCH 2", "load 2", "LOAD", "LOAD 2 3", "LOAD -3",
+                           "LOAD x", "LOAD 2x",
+                           "LOAD 99999999999999999999999"}) {
+    check::subject = text;
+    CostModel refused;
+    EXPECT(!parses(path, text, refused));
+  }
+  check::subject = "missing";
+  CostModel missing;
+  EXPECT(!load_costs(missing, directory / "missing.cost"));
+
+  check_engine("switch", [](Simulator &sim) { sim.run(); }, model);
+  check_engine("threaded", [](Simulator &sim) { sim.run_threaded(); }, model);
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return check::status();
+}
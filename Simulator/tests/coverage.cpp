@@ -0,0 +1,120 @@
+// Checks that coverage worked out from either engine's run says which
+// addresses ran and which ways their jumps went, that merging runs which
+// took different paths covers both, in either order, and that it survives
+// a round trip through a coverage file.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../libs/coverage.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// The addresses set in bits.
+std::vector<uint16_t> addresses(const std::vector<uint64_t> &bits) {
+  std::vector<uint16_t> set;
+  for (uint32_t at = 0; at < bits.size() * 64; ++at) {
+    if (Coverage::has(bits, static_cast<uint16_t>(at))) {
+      set.push_back(static_cast<uint16_t>(at));
+    }
+  }
+  return set;
+}
+
+bool same(const Coverage &a, const Coverage &b) {
+  return a.program == b.program &&
+         addresses(a.executed) == addresses(b.executed) &&
+         addresses(a.taken) == addresses(b.taken) &&
+         addresses(a.not_taken) == addresses(b.not_taken);
+}
+
+// SUM run on input, with its jumps counted.
+template <typename Run>
+Coverage covered(Run &&run, const std::vector<int16_t> &input) {
+  Simulator sim = loaded({SUM.name, SUM.image, input});
+  sim.count_jumps();
+  run(sim);
+  return Coverage::of(sim, SUM.image);
+}
+
+template <typename Run>
+void check_engine(const std::string &engine, Run &&run,
+                  const std::filesystem::path &path) {
+  check::subject = engine;
+
+  // Zero straight away: the JUMPEQ at 3 is taken and nothing in the loop
+  // runs.
+  const Coverage zero = covered(run, {0});
+  EXPECT(zero.program == Coverage::fingerprint(SUM.image));
+  EXPECT(addresses(zero.executed) ==
+         std::vector<uint16_t>({0, 1, 2, 3, 9, 10}));
+  EXPECT(Coverage::has(zero.taken, 3) && !Coverage::has(zero.not_taken, 3));
+
+  // One number and then no more: the loop runs once, and the program stops
+  // at the IN at 0 with the JUMPEQ never taken.
+  const Coverage once = covered(run, {4});
+  EXPECT(addresses(once.executed) ==
+         std::vector<uint16_t>({0, 1, 2, 3, 4, 5, 6, 7, 8}));
+  EXPECT(!Coverage::has(once.taken, 3) && Coverage::has(once.not_taken, 3));
+  EXPECT(Coverage::has(once.taken, 8));
+
+  Coverage both = zero;
+  both.merge(once);
+  EXPECT(addresses(both.executed) ==
+         std::vector<uint16_t>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10}));
+  EXPECT(Coverage::has(both.taken, 3) && Coverage::has(both.not_taken, 3));
+  EXPECT(same(both, covered(run, {4, 0})));
+
+  Coverage reversed = once;
+  reversed.merge(zero);
+  EXPECT(same(reversed, both));
+
+  // Merged into nothing, a run's coverage is just its own.
+  Coverage empty{};
+  empty.program = both.program;
+  empty.merge(both);
+  EXPECT(same(empty, both));
+
+  EXPECT(save_coverage(both, path));
+  Coverage loaded_back;
+  EXPECT(load_coverage(loaded_back, path));
+  EXPECT(same(loaded_back, both));
+}
+
+} // namespace
+
+auto main() -> int {
+  const auto directory = std::filesystem::temp_directory_path() /
+                         ("si-test-coverage-" + std::to_string(getpid()));
+  std::filesystem::create_directories(directory);
+  const auto path = directory / "run.cov";
+
+  check_engine("switch", [](Simulator &sim) { sim.run(); }, path);
+  check_engine("threaded", [](Simulator &sim) { sim.run_threaded(); }, path);
+
+  check::subject = "another program";
+  EXPECT(Coverage::fingerprint(COUNT.image) !=
+         Coverage::fingerprint(SUM.image));
+
+  check::subject = "damaged";
+  Coverage run;
+  EXPECT(!load_coverage(run, directory / "missing.cov"));
+  const auto size = std::filesystem::file_size(path);
+  std::filesystem::resize_file(path, size - 1);
+  EXPECT(!load_coverage(run, path));
+  std::ofstream(path, std::ios::binary) << "MNIO";
+  EXPECT(!load_coverage(run, path));
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return check::status();
+}
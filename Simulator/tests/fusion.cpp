@@ -0,0 +1,68 @@
+// Checks that run_threaded() with fusion leaves each program exactly as
+// run() does, counting every instruction in a superinstruction, and that
+// jumping into the middle of a fused sequence, or writing over part of one,
+// still works.
+
+#include <cstdint>
+#include <vector>
+
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// Jumps over the LOAD of a LOAD; ADD; STORE.
+const Program MIDDLE = {"middle",
+                        {
+                            0x0007, // 0: LOAD one
+                            0x8003, //    JUMP 3
+                            0x0008, //    LOAD x
+                            0x3007, // 3: ADD one
+                            0x1008, //    STORE x
+                            0xE008, // 5: OUT x
+                            0xF000, //    HALT
+                            1,      //    one
+                            40,     //    x
+                        },
+                        {}};
+
+} // namespace
+
+auto main() -> int {
+  auto programs = PROGRAMS;
+  programs.push_back(MIDDLE);
+  for (const auto &program : programs) {
+    check::subject = program.name;
+
+    Simulator switched = loaded(program);
+    switched.run();
+
+    Simulator fused = loaded(program);
+    fused.enable_fusion();
+    fused.run_threaded();
+    EXPECT(Outcome::of(fused) == Outcome::of(switched));
+    EXPECT(fused.instructions() == switched.instructions());
+  }
+
+  check::subject = COUNT.name;
+  Simulator count = loaded(COUNT);
+  count.enable_fusion();
+  count.run_threaded();
+  EXPECT(count.fusions()[Simulator::LOAD_ADD_STORE] == 10);
+  EXPECT(count.fusions()[Simulator::DECREMENT_LOAD_COMPARE_JUMPNEQ] == 10);
+
+  check::subject = PATCH.name;
+  Simulator patch = loaded(PATCH);
+  patch.enable_fusion();
+  patch.run_threaded();
+  EXPECT(patch.captured_output() == std::vector<int16_t>({6, 5}));
+
+  check::subject = MIDDLE.name;
+  Simulator middle = loaded(MIDDLE);
+  middle.enable_fusion();
+  middle.run_threaded();
+  EXPECT(middle.captured_output() == std::vector<int16_t>({2}));
+
+  return check::status();
+}
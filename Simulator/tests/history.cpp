@@ -0,0 +1,128 @@
+// Checks that History takes a simulator back one instruction at a time
+// through exactly the states it went through, memory and registers both,
+// including across the snapshots of a long run; that going forward again
+// reads the same input and doesn't write output twice; and that reverse
+// continuing stops where the last breakpoint or watched write was.
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "../libs/history.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// Counts n down to zero, five instructions at a time, for long enough to
+// take more than one snapshot.
+const Program DOWN = {"down",
+                      {
+                          0x0006, // 0: LOAD n
+                          0x5007, //    SUBTRACT one
+                          0x1006, //    STORE n
+                          0x7008, //    COMPARE zero
+                          0xC000, //    JUMPNEQ 0
+                          0xF000, // 5: HALT
+                          60000,  //    n
+                          1,      //    one
+                          0,      //    zero
+                      },
+                      {}};
+
+// Where a run is, leaving out the output, which isn't taken back.
+Outcome where(const Simulator &sim) {
+  Outcome state = Outcome::of(sim);
+  state.output.clear();
+  return state;
+}
+
+// Where a run of program is after count instructions, stepping it.
+Outcome stepped(const Program &program, uint64_t count) {
+  Simulator sim = loaded(program);
+  while (sim.instructions() < count) {
+    sim.step();
+  }
+  return where(sim);
+}
+
+} // namespace
+
+auto main() -> int {
+  for (const auto &program : PROGRAMS) {
+    check::subject = program.name;
+
+    Simulator sim = loaded(program);
+    History history(sim);
+    history.run_threaded();
+    EXPECT(sim.halted());
+    const Outcome finished = Outcome::of(sim);
+    const uint64_t count = sim.instructions();
+
+    // Every state on the way back, stepping forward to it from the start.
+    std::vector<Outcome> states;
+    for (uint64_t at = 0; at <= count; ++at) {
+      states.push_back(stepped(program, at));
+    }
+    for (uint64_t at = count; at-- > 0;) {
+      EXPECT(history.step_back());
+      EXPECT(sim.instructions() == at);
+      EXPECT(where(sim) == states[at]);
+    }
+    EXPECT(!history.step_back());
+    EXPECT(sim.instructions() == 0);
+
+    // Going forward again reads the input already read, and the output
+    // written the first time round is left as it was.
+    history.run_threaded();
+    EXPECT(Outcome::of(sim) == finished);
+    EXPECT(sim.instructions() == count);
+  }
+
+  // Back from the end of the run, SUM was last about to write its total
+  // before the last STORE, and last at the OUT before that.
+  check::subject = "reverse continue";
+  Simulator sum = loaded(SUM);
+  History back(sum);
+  back.run_threaded();
+  sum.watch(0xFFF0);
+  auto hit = back.reverse_continue();
+  EXPECT(hit && hit->kind == Simulator::Hit::WATCHPOINT &&
+         hit->address == 0xFFF0);
+  EXPECT(sum.program_counter() == 5);
+  EXPECT(static_cast<int16_t>(sum.memory(0xFFF0)) == -30528);
+  EXPECT(static_cast<int16_t>(sum.accumulator()) == -30529);
+  sum.unwatch(0xFFF0);
+  sum.set_breakpoint(6);
+  hit = back.reverse_continue();
+  EXPECT(hit && hit->kind == Simulator::Hit::BREAKPOINT && hit->address == 6);
+  EXPECT(sum.program_counter() == 6);
+  EXPECT(static_cast<int16_t>(sum.memory(0xFFF0)) == -30528);
+  sum.clear_breakpoint(6);
+  EXPECT(!back.reverse_continue());
+  EXPECT(sum.instructions() == 0 && where(sum) == stepped(SUM, 0));
+
+  // Going back a hundred thousand instructions from the end of a run of
+  // three hundred thousand goes past more than one of the snapshots saved
+  // on the way.
+  check::subject = "long";
+  Simulator down = loaded(DOWN);
+  History long_way(down);
+  long_way.run_threaded();
+  const uint64_t end = down.instructions();
+  EXPECT(end == 60000 * 5 + 1);
+  down.set_breakpoint(0);
+  hit = long_way.reverse_continue();
+  EXPECT(hit && hit->kind == Simulator::Hit::BREAKPOINT);
+  EXPECT(down.instructions() == end - 6);
+  EXPECT(where(down) == stepped(DOWN, end - 6));
+  down.clear_breakpoint(0);
+  for (int i = 0; i < 100000; ++i) {
+    long_way.step_back();
+  }
+  EXPECT(down.instructions() == end - 100006);
+  EXPECT(where(down) == stepped(DOWN, end - 100006));
+
+  return check::status();
+}
@@ -0,0 +1,63 @@
+// Checks that the JIT leaves each program exactly as run() does, having
+// counted as many instructions, run straight through or fed its input a
+// value at a time, and that its code cache is never mapped writable and
+// executable at once.
+
+#include <fstream>
+#include <string>
+
+#include "../libs/jit.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+#if defined(SIMULATOR_HAS_JIT)
+namespace {
+
+// Whether any of the process's mappings is writable and executable.
+bool mapped_rwx() {
+  std::ifstream maps("/proc/self/maps");
+  for (std::string line; std::getline(maps, line);) {
+    if (line.find(" rwx") != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+#endif
+
+auto main() -> int {
+  for (const auto &program : PROGRAMS) {
+    check::subject = program.name;
+
+    Simulator switched = loaded(program);
+    switched.run();
+
+    Simulator compiled = loaded(program);
+    {
+      Jit jit(compiled);
+      jit.run();
+#if defined(SIMULATOR_HAS_JIT)
+      EXPECT(!mapped_rwx());
+#endif
+    }
+    EXPECT(Outcome::of(compiled) == Outcome::of(switched));
+    EXPECT(compiled.instructions() == switched.instructions());
+
+    // Each IN leaves generated code, and the next run() starts from there.
+    Simulator fed = loaded({program.name, program.image, {}});
+    Jit jit(fed);
+    for (const auto value : program.input) {
+      jit.run();
+      EXPECT(fed.waiting_for_input());
+      fed.feed({value});
+    }
+    jit.run();
+    EXPECT(Outcome::of(fed) == Outcome::of(switched));
+    EXPECT(fed.instructions() == switched.instructions());
+  }
+
+  return check::status();
+}
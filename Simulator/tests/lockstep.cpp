@@ -0,0 +1,55 @@
+// Checks that each lane of a lockstep run ends the way run() ends with the
+// same input, with enough vectors for several groups and a partial one,
+// and lanes which split apart, halt or run out of input at different
+// points.
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "../libs/lockstep.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+auto main() -> int {
+#if defined(SIMULATOR_HAS_LOCKSTEP)
+  std::mt19937 random(5);
+  std::uniform_int_distribution<int> length(0, 8);
+  std::uniform_int_distribution<int> values(-0x7FFF, 0x7FFF);
+  for (const auto &program : PROGRAMS) {
+    check::subject = program.name;
+
+    // Up to eight numbers, each nonzero but for the last, which is zero
+    // (ending SUM) in three vectors out of four.
+    std::vector<std::vector<int16_t>> inputs{program.input};
+    for (int lane = 1; lane < 2 * Lockstep::WIDTH + 7; ++lane) {
+      std::vector<int16_t> input(static_cast<std::size_t>(length(random)));
+      for (auto &value : input) {
+        value = static_cast<int16_t>(values(random));
+        value = value == 0 ? 1 : value;
+      }
+      if (!input.empty() && random() % 4 != 0) {
+        input.back() = 0;
+      }
+      inputs.push_back(input);
+    }
+
+    Lockstep lockstep(program.image, inputs);
+    lockstep.run();
+    EXPECT(lockstep.lanes().size() == inputs.size());
+
+    for (std::size_t lane = 0; lane < inputs.size(); ++lane) {
+      Simulator sim = loaded({program.name, program.image, inputs[lane]});
+      sim.run();
+      const auto &result = lockstep.lanes()[lane];
+      EXPECT(result.output == sim.captured_output());
+      EXPECT((result.status == Lockstep::Status::HALTED) == sim.halted());
+      EXPECT((result.status == Lockstep::Status::WAITING_FOR_INPUT) ==
+             sim.waiting_for_input());
+    }
+  }
+#endif
+
+  return check::status();
+}
@@ -0,0 +1,90 @@
+// Checks that both engines stop a program going round a loop it can never
+// leave, saying where the loop is, and never stop one that finishes, even
+// when it goes back to the same place with nothing changed but its input.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// Prints x, then waits for it to equal y, which it never will.
+const Program SPIN = {"spin",
+                      {
+                          0xE005, // 0: OUT x
+                          0x0005, // 1: LOAD x
+                          0x7006, //    COMPARE y
+                          0xC001, // 3: JUMPNEQ 1
+                          0xF000, //    HALT
+                          1,      //    x
+                          2,      //    y
+                      },
+                      {}};
+
+// Jumps to itself.
+const Program SELF = {"self", {0x8000}, {}};
+
+// Reads the same value over and over until it's given a zero.
+const Program POLL = {"poll",
+                      {
+                          0xD004, // 0: IN x
+                          0x7005, //    COMPARE zero
+                          0xC000, //    JUMPNEQ 0
+                          0xF000, //    HALT
+                          0,      //    x
+                          0,      //    zero
+                      },
+                      {7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0}};
+
+template <typename Run>
+void check_engine(const std::string &engine, Run &&run) {
+  for (const auto &program : {SPIN, SELF}) {
+    check::subject = engine + ' ' + program.name;
+    Simulator sim = loaded(program);
+    sim.detect_loops();
+    // So that missing the loop fails rather than hangs.
+    sim.limit_instructions(1 << 20);
+    run(sim);
+    EXPECT(!sim.halted() && !sim.out_of_budget());
+    EXPECT(sim.infinite_loop().has_value());
+    // Stopped for good.
+    const uint64_t instructions = sim.instructions();
+    run(sim);
+    EXPECT(sim.instructions() == instructions);
+  }
+
+  check::subject = engine + ' ' + SPIN.name;
+  Simulator spin = loaded(SPIN);
+  spin.detect_loops();
+  run(spin);
+  EXPECT(spin.infinite_loop() && spin.infinite_loop()->first == 1 &&
+         spin.infinite_loop()->last == 3);
+  EXPECT(spin.program_counter() >= 1 && spin.program_counter() <= 3);
+  EXPECT(spin.captured_output() == std::vector<int16_t>({1}));
+
+  auto programs = PROGRAMS;
+  programs.push_back(POLL);
+  for (const auto &program : programs) {
+    check::subject = engine + ' ' + program.name;
+    Simulator plain = loaded(program);
+    run(plain);
+    Simulator detecting = loaded(program);
+    detecting.detect_loops();
+    run(detecting);
+    EXPECT(!detecting.infinite_loop());
+    EXPECT(Outcome::of(detecting) == Outcome::of(plain));
+    EXPECT(detecting.instructions() == plain.instructions());
+  }
+}
+
+} // namespace
+
+auto main() -> int {
+  check_engine("switch", [](Simulator &sim) { sim.run(); });
+  check_engine("threaded", [](Simulator &sim) { sim.run_threaded(); });
+  return check::status();
+}
@@ -0,0 +1,66 @@
+// Checks that a profile worked out from either engine's run counts how
+// many times each address executed, which way its jumps went, and how
+// many times each data word was loaded from and stored to, including the
+// word at the top of the window; and that the report finds the loop.
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "../libs/listing.hpp"
+#include "../libs/profile.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+template <typename Run>
+void check_engine(const std::string &engine, Run &&run) {
+  check::subject = engine;
+
+  // SUM reads seven numbers, going round its loop for all but the zero.
+  Simulator sim = loaded(SUM);
+  sim.count_jumps();
+  run(sim);
+  const Profile profile = Profile::of(sim);
+  for (uint16_t at = 0; at <= 10; ++at) {
+    const uint64_t expected = at <= 3 ? 7 : at <= 8 ? 6 : 1;
+    EXPECT(profile.executions[at] == expected);
+  }
+  EXPECT(profile.executions[11] == 0);
+
+  // The JUMPEQ at 3 is taken once, at the zero, and the JUMP back at 8
+  // every time it runs.
+  EXPECT(sim.jumps_taken()[3] == 1);
+  EXPECT(profile.executions[3] - sim.jumps_taken()[3] == 6);
+  EXPECT(sim.jumps_taken()[8] == 6);
+
+  // x is read in and loaded, n incremented and output, zero compared with,
+  // and the total added, stored and output.
+  EXPECT(profile.loads[0x00B] == 7 && profile.stores[0x00B] == 7);
+  EXPECT(profile.loads[0x00C] == 7 && profile.stores[0x00C] == 6);
+  EXPECT(profile.loads[0x00D] == 7 && profile.stores[0x00D] == 0);
+  EXPECT(profile.loads[Memory::index(0xFFF0)] == 12);
+  EXPECT(profile.stores[Memory::index(0xFFF0)] == 6);
+
+  std::ostringstream report;
+  report_profile(profile, SUM.image, Listing{}, sim.instructions(), report);
+  EXPECT(report.str().find("Hottest instructions (of 60 executed)") !=
+         std::string::npos);
+  EXPECT(report.str().find("0000-0008") != std::string::npos);
+  EXPECT(report.str().find("FFF0") != std::string::npos);
+
+  // Without count_jumps(), nothing is counted.
+  Simulator uncounted = loaded(SUM);
+  run(uncounted);
+  EXPECT(Profile::of(uncounted).executions[0] == 0);
+}
+
+} // namespace
+
+auto main() -> int {
+  check_engine("switch", [](Simulator &sim) { sim.run(); });
+  check_engine("threaded", [](Simulator &sim) { sim.run_threaded(); });
+  return check::status();
+}
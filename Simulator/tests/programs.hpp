@@ -0,0 +1,129 @@
+#ifndef PROGRAMS_HPP
+#define PROGRAMS_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "../libs/simulator.hpp"
+
+// Small programs which between them use every opcode, the top of the
+// memory window and code that writes over itself, with the input each
+// one is run on.
+struct Program {
+  const char *name;
+  std::vector<uint16_t> image;
+  std::vector<int16_t> input;
+};
+
+// Sums ten down to one, then says how the total compares with a limit.
+const Program COUNT = {"count",
+                       {
+                           0x2014, // 0:  CLEAR total
+                           0x0015, //     LOAD ten
+                           0x1016, //     STORE n
+                           0x0014, // 3:  LOAD total
+                           0x3016, //     ADD n
+                           0x1014, // 5:  STORE total
+                           0x6016, //     DECREMENT n
+                           0x0016, //     LOAD n
+                           0x7017, //     COMPARE zero
+                           0xC003, //     JUMPNEQ 3
+                           0xE014, // 10: OUT total
+                           0x0014, //     LOAD total
+                           0x7018, //     COMPARE limit
+                           0x9010, //     JUMPGT 16
+                           0xB012, //     JUMPLT 18
+                           0xF000, // 15: HALT
+                           0xE015, //     OUT ten
+                           0xF000, //     HALT
+                           0xE018, //     OUT limit
+                           0xF000, //     HALT
+                           7,      // 20: total
+                           10,     //     ten
+                           0,      //     n
+                           0,      //     zero
+                           50,     //     limit
+                       },
+                       {}};
+
+// Prints a running total of its input, kept at the top of the window,
+// until it reads a zero, and then how many numbers it read.
+const Program SUM = {"sum",
+                     {
+                         0xD00B, // 0:  IN x
+                         0x000B, //     LOAD x
+                         0x700D, //     COMPARE zero
+                         0xA009, //     JUMPEQ 9
+                         0x3FF0, //     ADD sum
+                         0x1FF0, // 5:  STORE sum
+                         0xEFF0, //     OUT sum
+                         0x400C, //     INCREMENT n
+                         0x8000, //     JUMP 0
+                         0xE00C, //     OUT n
+                         0xF000, // 10: HALT
+                         0,      //     x
+                         0,      //     n
+                         0,      //     zero
+                     },
+                     {3, -7, 12, 30000, 5000, -1, 0}};
+
+// Adds one to x and prints it, then turns the ADD into a SUBTRACT and
+// goes round again.
+const Program PATCH = {"patch",
+                       {
+                           0x000B, // 0:  LOAD x
+                           0x300C, //     ADD one
+                           0x100B, //     STORE x
+                           0xE00B, //     OUT x
+                           0x0001, //     LOAD 1
+                           0x700D, // 5:  COMPARE patch
+                           0xA00A, //     JUMPEQ 10
+                           0x000D, //     LOAD patch
+                           0x1001, //     STORE 1
+                           0x8000, //     JUMP 0
+                           0xF000, // 10: HALT
+                           5,      //     x
+                           1,      //     one
+                           0x500C, //     patch: SUBTRACT one
+                       },
+                       {}};
+
+const std::vector<Program> PROGRAMS = {COUNT, SUM, PATCH};
+
+// A simulator with program loaded and fed its input, keeping its output.
+inline Simulator loaded(const Program &program) {
+  Simulator sim{};
+  sim.fill(program.image);
+  sim.capture_output();
+  sim.feed(program.input);
+  return sim;
+}
+
+// Everything a run leaves behind, to compare one engine's run of a program
+// with another's.
+struct Outcome {
+  bool halted{false};
+  bool waiting{false};
+  uint16_t pc{0};
+  uint16_t r{0};
+  std::vector<int16_t> output{};
+  std::vector<uint16_t> memory{};
+
+  static Outcome of(const Simulator &sim) {
+    Outcome run{sim.halted(),        sim.waiting_for_input(),
+                sim.program_counter(), sim.accumulator(),
+                sim.captured_output(), {}};
+    for (int i = 0; i < Memory::WORDS; ++i) {
+      run.memory.push_back(sim.memory(Memory::address(i)));
+    }
+    return run;
+  }
+
+  bool operator==(const Outcome &other) const {
+    return halted == other.halted && waiting == other.waiting &&
+           pc == other.pc && r == other.r && output == other.output &&
+           memory == other.memory;
+  }
+};
+
+#endif // PROGRAMS_HPP
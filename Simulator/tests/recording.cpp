@@ -0,0 +1,147 @@
+// Checks that a run recorded by either engine survives a round trip
+// through a recording file and replays without diverging, and that a
+// replay stops where the program does something the recording doesn't
+// have: a different value, the same value at a different instruction, or
+// anything past the end.
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../libs/recording.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// SUM, loading x twice.
+const Program SLOWER = {"slower",
+                        {
+                            0xD00C, // 0:  IN x
+                            0x000C, //     LOAD x
+                            0x000C, //     LOAD x
+                            0x700E, //     COMPARE zero
+                            0xA00A, //     JUMPEQ 10
+                            0x3FF0, // 5:  ADD sum
+                            0x1FF0, //     STORE sum
+                            0xEFF0, //     OUT sum
+                            0x400D, //     INCREMENT n
+                            0x8000, //     JUMP 0
+                            0xE00D, // 10: OUT n
+                            0xF000, //     HALT
+                            0,      //     x
+                            0,      //     n
+                            0,      //     zero
+                        },
+                        {}};
+
+bool same(const std::vector<Simulator::IoEvent> &a,
+          const std::vector<Simulator::IoEvent> &b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                    [](const auto &x, const auto &y) {
+                      return x.instruction == y.instruction &&
+                             x.value == y.value && x.output == y.output;
+                    });
+}
+
+Program changed(const Program &program, uint16_t at, uint16_t instruction) {
+  Program copy = program;
+  copy.image[at] = instruction;
+  return copy;
+}
+
+// A simulator with program loaded, replaying script.
+Simulator replaying(const Program &program,
+                    const std::vector<Simulator::IoEvent> &script) {
+  Simulator sim{};
+  sim.fill(program.image);
+  sim.capture_output();
+  sim.replay_io(script);
+  return sim;
+}
+
+template <typename Run>
+void check_engine(const std::string &engine, Run &&run,
+                  const std::filesystem::path &path) {
+  check::subject = engine;
+
+  Simulator recorded = loaded(SUM);
+  recorded.record_io();
+  run(recorded);
+  const Recording original{recorded.io_record(), recorded.instructions()};
+  // Seven values in, and six running totals and the count out.
+  EXPECT(original.events.size() == 14);
+  EXPECT(original.events[0].instruction == 0 && !original.events[0].output);
+  EXPECT(original.events[1].value == 3 && original.events[1].output);
+
+  EXPECT(save_recording(original, path));
+  Recording loaded_back;
+  EXPECT(load_recording(loaded_back, path));
+  EXPECT(same(loaded_back.events, original.events));
+  EXPECT(loaded_back.instructions == original.instructions);
+
+  Simulator faithful = replaying(SUM, loaded_back.events);
+  run(faithful);
+  EXPECT(!faithful.diverged());
+  EXPECT(faithful.replayed_io() == original.events.size());
+  EXPECT(faithful.halted());
+  EXPECT(faithful.instructions() == original.instructions);
+  EXPECT(faithful.captured_output() == recorded.captured_output());
+
+  // Subtracting rather than adding, the second total printed is -10.
+  const Program subtracting = changed(SUM, 4, 0x5FF0);
+  Simulator wrong_value = replaying(subtracting, original.events);
+  run(wrong_value);
+  EXPECT(wrong_value.diverged() == std::optional<std::size_t>(3));
+  EXPECT(!wrong_value.halted() && wrong_value.program_counter() == 6);
+  EXPECT(wrong_value.captured_output() == std::vector<int16_t>({3}));
+
+  // Loading x twice prints the same totals, an instruction late.
+  Simulator late = replaying(SLOWER, original.events);
+  run(late);
+  EXPECT(late.diverged() == std::optional<std::size_t>(1));
+
+  // Without its last event, the count printed at the end is past the end
+  // of the recording.
+  auto cut = original.events;
+  cut.pop_back();
+  Simulator short_script = replaying(SUM, cut);
+  run(short_script);
+  EXPECT(short_script.diverged() == std::optional<std::size_t>(cut.size()));
+  EXPECT(!short_script.halted());
+}
+
+} // namespace
+
+auto main() -> int {
+  const auto directory = std::filesystem::temp_directory_path() /
+                         ("si-test-recording-" + std::to_string(getpid()));
+  std::filesystem::create_directories(directory);
+  const auto path = directory / "run.io";
+
+  check_engine("switch", [](Simulator &sim) { sim.run(); }, path);
+  check_engine("threaded", [](Simulator &sim) { sim.run_threaded(); }, path);
+
+  check::subject = "damaged";
+  Recording run;
+  EXPECT(!load_recording(run, directory / "missing.io"));
+  const auto size = std::filesystem::file_size(path);
+  std::filesystem::resize_file(path, size - 1);
+  EXPECT(!load_recording(run, path));
+  std::ofstream(path, std::ios::binary) << "MNIO";
+  EXPECT(!load_recording(run, path));
+  std::ofstream(path, std::ios::binary) << "NOPE";
+  EXPECT(!load_recording(run, path));
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return check::status();
+}
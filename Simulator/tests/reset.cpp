@@ -0,0 +1,75 @@
+// Checks that a simulator reset after a run, with either engine, runs the
+// program again exactly as a fresh one would: with none of the last run's
+// memory, registers, unread input, output or recorded I/O left over, and
+// a replay starting again from the beginning of its recording.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+bool same(const std::vector<Simulator::IoEvent> &a,
+          const std::vector<Simulator::IoEvent> &b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                    [](const auto &x, const auto &y) {
+                      return x.instruction == y.instruction &&
+                             x.value == y.value && x.output == y.output;
+                    });
+}
+
+template <typename Run>
+void check_engine(const std::string &engine, Run &&run) {
+  check::subject = engine;
+
+  // SUM stops reading at the zero, leaving the last two numbers unread.
+  Simulator reused = loaded({SUM.name, SUM.image, {3, -7, 0, 99, 98}});
+  reused.record_io();
+  run(reused);
+  EXPECT(reused.halted());
+  EXPECT(reused.captured_output() == std::vector<int16_t>({3, -4, 2}));
+
+  reused.reset();
+  EXPECT(reused.captured_output().empty() && reused.io_record().empty());
+  EXPECT(reused.instructions() == 0);
+  reused.feed({5, 0});
+  run(reused);
+
+  Simulator fresh = loaded({SUM.name, SUM.image, {5, 0}});
+  fresh.record_io();
+  run(fresh);
+  EXPECT(Outcome::of(reused) == Outcome::of(fresh));
+  EXPECT(reused.instructions() == fresh.instructions());
+  EXPECT(same(reused.io_record(), fresh.io_record()));
+
+  // Reset with nothing fed, it waits for input rather than reading what
+  // was left over.
+  reused.reset();
+  run(reused);
+  EXPECT(reused.waiting_for_input() && reused.instructions() == 0);
+
+  Simulator replayed{};
+  replayed.fill(SUM.image);
+  replayed.capture_output();
+  replayed.replay_io(fresh.io_record());
+  run(replayed);
+  EXPECT(!replayed.diverged() && replayed.halted());
+  replayed.reset();
+  run(replayed);
+  EXPECT(!replayed.diverged() && replayed.halted());
+  EXPECT(replayed.replayed_io() == fresh.io_record().size());
+  EXPECT(Outcome::of(replayed) == Outcome::of(fresh));
+}
+
+} // namespace
+
+auto main() -> int {
+  check_engine("switch", [](Simulator &sim) { sim.run(); });
+  check_engine("threaded", [](Simulator &sim) { sim.run_threaded(); });
+  return check::status();
+}
@@ -0,0 +1,95 @@
+// Checks that the sanitizer flags each instruction which reads a word
+// before it's been given a value, once, at the address it read, and no
+// others: not words the image has a value for, nor ones the program
+// stored to, cleared or read in first.
+
+#include <cstdint>
+#include <sstream>
+#include <vector>
+
+#include "../libs/listing.hpp"
+#include "../libs/sanitizer.hpp"
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// Reads past the end of its image: at the top of the window, and a word
+// which is read again after it has been cleared.
+const Program UNSET = {"unset",
+                       {
+                           0x2011, // 0:  CLEAR cleared
+                           0x0011, //     LOAD cleared
+                           0x400F, //     INCREMENT counted
+                           0x7FF0, //     COMPARE top
+                           0x3010, //     ADD unset
+                           0x3010, // 5:  ADD unset
+                           0x1FF1, //     STORE stored
+                           0x0FF1, //     LOAD stored
+                           0x600C, //     DECREMENT n
+                           0xC002, //     JUMPNEQ 2
+                           0xE010, // 10: OUT unset
+                           0xF000, //     HALT
+                           2,      //     n
+                       },
+                       {}};
+
+bool flagged(const UninitializedRead &read, uint16_t at, uint16_t word) {
+  return read.at == at && read.word == word &&
+         read.instruction == UNSET.image[at];
+}
+
+std::vector<UninitializedRead> sanitized(const Program &program) {
+  Simulator sim = loaded(program);
+  sim.sanitize();
+  sim.run_threaded();
+  EXPECT(sim.halted());
+  return sim.uninitialized_reads();
+}
+
+} // namespace
+
+auto main() -> int {
+  // Every word the others read has a value, from the image or from the
+  // program.
+  for (const auto &program : PROGRAMS) {
+    check::subject = program.name;
+    EXPECT(sanitized(program).empty() == (program.name != SUM.name));
+  }
+
+  // SUM adds to its total at the top of the window before it has stored
+  // to it, and only the first time round.
+  check::subject = SUM.name;
+  const auto sum = sanitized(SUM);
+  EXPECT(sum.size() == 1 && sum[0].at == 4 && sum[0].word == 0xFFF0 &&
+         sum[0].instruction == 0x3FF0);
+
+  // Each instruction reading an unset word is flagged once, however many
+  // times round the loop, even if another has already read the same word.
+  // INCREMENT gives counted a value after reading it, and the cleared and
+  // stored words aren't read before they have one.
+  check::subject = UNSET.name;
+  const auto reads = sanitized(UNSET);
+  EXPECT(reads.size() == 5);
+  if (reads.size() == 5) {
+    EXPECT(flagged(reads[0], 2, 0x000F));
+    EXPECT(flagged(reads[1], 3, 0xFFF0));
+    EXPECT(flagged(reads[2], 4, 0x0010));
+    EXPECT(flagged(reads[3], 5, 0x0010));
+    EXPECT(flagged(reads[4], 10, 0x0010));
+  }
+
+  std::ostringstream report;
+  report_uninitialized(reads, Listing{}, report);
+  EXPECT(report.str().find("  0003 read FFF0  COMPARE FFF0\n") !=
+         std::string::npos);
+
+  // Without sanitize(), nothing is checked.
+  check::subject = "not sanitizing";
+  Simulator unchecked = loaded(UNSET);
+  unchecked.run_threaded();
+  EXPECT(unchecked.halted() && unchecked.uninitialized_reads().empty());
+
+  return check::status();
+}
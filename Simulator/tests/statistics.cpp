@@ -0,0 +1,129 @@
+// Checks that statistics worked out from either engine's run count each
+// opcode, which way each kind of jump went, the I/O and the words used,
+// and that they're written out as one JSON object per run, or in the
+// OpenMetrics text format, to a stream or a file, with awkward program
+// names quoted.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../libs/simulator.hpp"
+#include "../libs/statistics.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// SUM reads seven numbers, and goes round its loop for all but the zero.
+const std::string SUM_JSON =
+    "{\"program\":\"sum\",\"instructions\":60,\"opcodes\":{\"LOAD\":7,"
+    "\"STORE\":6,\"CLEAR\":0,\"ADD\":6,\"INCREMENT\":6,\"SUBTRACT\":0,"
+    "\"DECREMENT\":0,\"COMPARE\":7,\"JUMP\":6,\"JUMPGT\":0,\"JUMPEQ\":7,"
+    "\"JUMPLT\":0,\"JUMPNEQ\":0,\"IN\":7,\"OUT\":7,\"HALT\":1},\"jumps\":{"
+    "\"JUMP\":{\"taken\":6,\"not_taken\":0},"
+    "\"JUMPGT\":{\"taken\":0,\"not_taken\":0},"
+    "\"JUMPEQ\":{\"taken\":1,\"not_taken\":6},"
+    "\"JUMPLT\":{\"taken\":0,\"not_taken\":0},"
+    "\"JUMPNEQ\":{\"taken\":0,\"not_taken\":0}},\"inputs\":7,\"outputs\":7,"
+    "\"words_touched\":4,\"wall_seconds\":2,\"instructions_per_second\":30}\n";
+
+bool contains(const std::string &text, const std::string &line) {
+  return text.find(line + '\n') != std::string::npos;
+}
+
+std::string contents(const std::filesystem::path &path) {
+  std::ifstream file(path);
+  return {std::istreambuf_iterator<char>(file),
+          std::istreambuf_iterator<char>()};
+}
+
+template <typename Run>
+void check_engine(const std::string &engine, Run &&run,
+                  const std::filesystem::path &path) {
+  check::subject = engine;
+
+  Simulator sim = loaded(SUM);
+  sim.count_jumps();
+  run(sim);
+  const Statistics sum = Statistics::of(sim, SUM.name, 2);
+  EXPECT(sum.instructions == sim.instructions());
+  EXPECT(sum.opcodes[Simulator::JEQ >> 12] == 7);
+  EXPECT(sum.taken[2] == 1 && sum.not_taken[2] == 6);
+  EXPECT(sum.inputs == 7 && sum.outputs == 7 && sum.words == 4);
+  EXPECT(sum.per_second() == 30);
+
+  std::ostringstream json;
+  write_json({sum}, json);
+  EXPECT(json.str() == SUM_JSON);
+
+  // COUNT goes round its loop ten times, and then past the JUMPGT to the
+  // JUMPLT, which is taken.
+  Simulator count = loaded(COUNT);
+  count.count_jumps();
+  run(count);
+  const Statistics other = Statistics::of(count, COUNT.name, 0);
+  EXPECT(other.taken[1] == 0 && other.not_taken[1] == 1);
+  EXPECT(other.taken[3] == 1 && other.not_taken[3] == 0);
+  EXPECT(other.taken[4] == 9 && other.not_taken[4] == 1);
+  EXPECT(other.per_second() == 0);
+
+  std::ostringstream metrics;
+  write_openmetrics({sum, other}, metrics);
+  const std::string text = metrics.str();
+  EXPECT(contains(text, "# TYPE si_instructions counter"));
+  EXPECT(contains(text,
+                  "si_instructions_total{program=\"sum\",opcode=\"OUT\"} 7"));
+  EXPECT(contains(text, "si_jumps_total{program=\"sum\",opcode=\"JUMPEQ\","
+                        "taken=\"true\"} 1"));
+  EXPECT(contains(text, "si_jumps_total{program=\"count\","
+                        "opcode=\"JUMPNEQ\",taken=\"false\"} 1"));
+  EXPECT(contains(text, "si_words_touched{program=\"count\"} 5"));
+  EXPECT(contains(text, "si_instructions_per_second{program=\"sum\"} 30"));
+  EXPECT(text.size() >= 6 &&
+         text.compare(text.size() - 6, 6, "# EOF\n") == 0);
+
+  EXPECT(save_statistics({sum, other}, "openmetrics", path));
+  EXPECT(contents(path) == text);
+  EXPECT(save_statistics({sum}, "json", path));
+  EXPECT(contents(path) == SUM_JSON);
+}
+
+} // namespace
+
+auto main() -> int {
+  const auto directory = std::filesystem::temp_directory_path() /
+                         ("si-test-statistics-" + std::to_string(getpid()));
+  std::filesystem::create_directories(directory);
+  const auto path = directory / "run.stats";
+
+  check_engine("switch", [](Simulator &sim) { sim.run(); }, path);
+  check_engine("threaded", [](Simulator &sim) { sim.run_threaded(); }, path);
+
+  // Quotes, backslashes and newlines are escaped the way each format
+  // escapes them.
+  check::subject = "quoted";
+  Statistics awkward;
+  awkward.program = "say \"hi\"\\\n";
+  std::ostringstream json;
+  write_json({awkward}, json);
+  EXPECT(json.str().rfind(R"({"program":"say \"hi\"\\\u000a",)", 0) == 0);
+  std::ostringstream metrics;
+  write_openmetrics({awkward}, metrics);
+  EXPECT(contains(metrics.str(),
+                  R"(si_inputs_total{program="say \"hi\"\\\n"} 0)"));
+
+  check::subject = "unwritable";
+  EXPECT(!save_statistics({awkward}, "json", directory / "missing" / "x"));
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return check::status();
+}
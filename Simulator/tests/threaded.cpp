@@ -0,0 +1,58 @@
+// Checks that run_threaded() leaves each program exactly as run() does,
+// run straight through, paused every few instructions, or fed its input a
+// value at a time.
+
+#include <cstdint>
+#include <vector>
+
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+auto main() -> int {
+  for (const auto &program : PROGRAMS) {
+    check::subject = program.name;
+
+    Simulator switched = loaded(program);
+    switched.run();
+    EXPECT(switched.halted());
+
+    Simulator threaded = loaded(program);
+    threaded.run_threaded();
+    EXPECT(Outcome::of(threaded) == Outcome::of(switched));
+    EXPECT(threaded.instructions() == switched.instructions());
+
+    // Pauses only happen at backward jumps, so this stops at each one.
+    Simulator paused = loaded(program);
+    while (!paused.halted()) {
+      paused.pause_after(paused.instructions() + 1);
+      paused.run_threaded();
+    }
+    EXPECT(Outcome::of(paused) == Outcome::of(switched));
+    EXPECT(paused.instructions() == switched.instructions());
+
+    Simulator fed = loaded({program.name, program.image, {}});
+    for (const auto value : program.input) {
+      fed.run_threaded();
+      EXPECT(fed.waiting_for_input());
+      fed.feed({value});
+    }
+    fed.run_threaded();
+    EXPECT(Outcome::of(fed) == Outcome::of(switched));
+    EXPECT(fed.instructions() == switched.instructions());
+  }
+
+  check::subject = SUM.name;
+  Simulator sum = loaded(SUM);
+  sum.run_threaded();
+  EXPECT(sum.captured_output() ==
+         std::vector<int16_t>({3, -4, 8, 30008, -30528, -30529, 6}));
+
+  check::subject = PATCH.name;
+  Simulator patch = loaded(PATCH);
+  patch.run_threaded();
+  EXPECT(patch.captured_output() == std::vector<int16_t>({6, 5}));
+  EXPECT(patch.memory(1) == 0x500C);
+
+  return check::status();
+}
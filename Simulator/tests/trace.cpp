@@ -0,0 +1,148 @@
+// Checks that a control-flow trace written to a file expands back into
+// every instruction the run executed, in order, with the way each
+// conditional jump went and each value read and written; that a trace cut
+// short expands as far as it goes; and that one which doesn't fit the
+// program, or isn't a trace, is refused.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../libs/simulator.hpp"
+#include "../libs/trace.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+// Counts n down from 150, a conditional jump each time round, so that the
+// trace takes more than one word of them.
+const Program DOWN = {"down",
+                      {
+                          0x0006, // 0: LOAD n
+                          0x5007, //    SUBTRACT one
+                          0x1006, //    STORE n
+                          0x7008, //    COMPARE zero
+                          0xC000, //    JUMPNEQ 0
+                          0xF000, // 5: HALT
+                          150,    //    n
+                          1,      //    one
+                          0,      //    zero
+                      },
+                      {}};
+
+// Traces a run of program with the threaded engine into path.
+Simulator traced(const Program &program, const std::filesystem::path &path) {
+  Simulator sim = loaded(program);
+  TraceWriter writer(path);
+  sim.trace_control_flow([&writer](const uint64_t *words, std::size_t count) {
+    writer.write(words, count);
+  });
+  sim.run_threaded();
+  sim.finish_trace();
+  EXPECT(writer.close());
+  return sim;
+}
+
+// What the expansion of a run of program should say, one line per
+// instruction, worked out by stepping it.
+std::vector<std::string> stepped(const Program &program, uint64_t count) {
+  std::vector<std::string> lines;
+  Simulator sim = loaded(program);
+  while (!sim.halted() && sim.instructions() < count) {
+    const uint16_t address = sim.program_counter();
+    const uint16_t instruction = sim.memory(address);
+    const MicroOp op{instruction};
+    const std::size_t outputs = sim.captured_output().size();
+    std::ostringstream line;
+    line << sim.instructions() << ' ' << std::hex << std::setfill('0')
+         << std::setw(4) << address << ' ' << std::setw(4) << instruction
+         << ' ' << Simulator::mnemonic(instruction) << ' ' << op.operand
+         << std::dec;
+    sim.step();
+
+    const uint16_t code = instruction & 0xF000;
+    if (code >= Simulator::JGT && code <= Simulator::JNEQ) {
+      line << (sim.program_counter() == op.operand ? " taken"
+                                                   : " not taken");
+    } else if (code == Simulator::IN) {
+      line << " <- " << static_cast<int16_t>(sim.memory(op.operand));
+    } else if (sim.captured_output().size() != outputs) {
+      line << " -> " << sim.captured_output().back();
+    }
+    lines.push_back(line.str());
+  }
+  return lines;
+}
+
+std::vector<std::string> expanded(const Program &program,
+                                  const std::filesystem::path &path,
+                                  bool &fits) {
+  std::ostringstream out;
+  fits = expand_trace(program.image, path, out);
+  std::vector<std::string> lines;
+  std::istringstream text(out.str());
+  for (std::string line; std::getline(text, line);) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+} // namespace
+
+auto main() -> int {
+  const auto directory = std::filesystem::temp_directory_path() /
+                         ("si-test-trace-" + std::to_string(getpid()));
+  std::filesystem::create_directories(directory);
+  const auto path = directory / "run.trace";
+
+  auto programs = PROGRAMS;
+  programs.push_back(DOWN);
+  for (const auto &program : programs) {
+    check::subject = program.name;
+
+    const Simulator run = traced(program, path);
+    bool fits = false;
+    const auto lines = expanded(program, path, fits);
+    EXPECT(fits);
+    EXPECT(lines.size() == run.instructions());
+    EXPECT(lines == stepped(program, run.instructions()));
+  }
+
+  // Without the end, or the last 26 of its 150 jumps, a trace expands up
+  // to the first jump it doesn't have.
+  check::subject = "cut short";
+  traced(DOWN, path);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 16);
+  bool fits = false;
+  const auto lines = expanded(DOWN, path, fits);
+  EXPECT(fits);
+  EXPECT(lines.size() == 124 * 5 + 4);
+  EXPECT(lines == stepped(DOWN, 124 * 5 + 4));
+
+  // Counting down from 149, the program ends a jump before the trace does.
+  check::subject = "another program";
+  traced(DOWN, path);
+  Program other = DOWN;
+  other.image[6] = 149;
+  expanded(other, path, fits);
+  EXPECT(!fits);
+
+  check::subject = "not a trace";
+  std::ofstream(path, std::ios::binary) << "MNIO\x01";
+  expanded(DOWN, path, fits);
+  EXPECT(!fits);
+  expanded(DOWN, directory / "missing.trace", fits);
+  EXPECT(!fits);
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return check::status();
+}
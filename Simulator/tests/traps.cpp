@@ -0,0 +1,101 @@
+// Checks that run_threaded() stops before a breakpoint, and before each
+// instruction which writes a watched word, saying which address it stopped
+// for, even at the top of the window; that carrying on from there runs the
+// instruction it stopped before; that traps set or cleared while stopped
+// take effect; and that a run stopped along the way ends as if it hadn't.
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "../libs/simulator.hpp"
+#include "check.hpp"
+#include "programs.hpp"
+
+namespace {
+
+bool stopped_at(const Simulator &sim, Simulator::Hit::Kind kind,
+                uint16_t address, uint16_t pc) {
+  const auto &hit = sim.hit();
+  return hit && hit->kind == kind && hit->address == address &&
+         sim.program_counter() == pc && !sim.halted();
+}
+
+Outcome straight(const Program &program) {
+  Simulator sim = loaded(program);
+  sim.run_threaded();
+  return Outcome::of(sim);
+}
+
+} // namespace
+
+auto main() -> int {
+  // SUM stops before each OUT of its running total.
+  check::subject = "breakpoint";
+  Simulator broken = loaded(SUM);
+  broken.set_breakpoint(6);
+  broken.run_threaded();
+  EXPECT(stopped_at(broken, Simulator::Hit::BREAKPOINT, 6, 6));
+  EXPECT(broken.captured_output().empty());
+  broken.run_threaded();
+  EXPECT(stopped_at(broken, Simulator::Hit::BREAKPOINT, 6, 6));
+  EXPECT(broken.captured_output() == std::vector<int16_t>({3}));
+  broken.clear_breakpoint(6);
+  broken.run_threaded();
+  EXPECT(!broken.hit() && broken.halted());
+  EXPECT(Outcome::of(broken) == straight(SUM));
+
+  // run() doesn't stop at them.
+  check::subject = "run()";
+  Simulator ignoring = loaded(SUM);
+  ignoring.set_breakpoint(6);
+  ignoring.watch(0xFFF0);
+  ignoring.run();
+  EXPECT(!ignoring.hit() && ignoring.halted());
+  EXPECT(Outcome::of(ignoring) == straight(SUM));
+
+  // SUM keeps its total at 0xFFF0, which the STORE at 5 writes before the
+  // write happens.
+  check::subject = "watchpoint at the top";
+  Simulator watched = loaded(SUM);
+  watched.watch(0xFFF0);
+  watched.run_threaded();
+  EXPECT(stopped_at(watched, Simulator::Hit::WATCHPOINT, 0xFFF0, 5));
+  EXPECT(watched.memory(0xFFF0) == 0 && watched.accumulator() == 3);
+  watched.run_threaded();
+  EXPECT(stopped_at(watched, Simulator::Hit::WATCHPOINT, 0xFFF0, 5));
+  EXPECT(watched.memory(0xFFF0) == 3);
+
+  // A breakpoint set while stopped, at the OUT of the count after the
+  // loop, is where the run stops once the watchpoint is gone.
+  watched.set_breakpoint(9);
+  watched.unwatch(0xFFF0);
+  watched.run_threaded();
+  EXPECT(stopped_at(watched, Simulator::Hit::BREAKPOINT, 9, 9));
+  EXPECT(static_cast<int16_t>(watched.memory(0xFFF0)) == -30529);
+  watched.run_threaded();
+  EXPECT(!watched.hit() && watched.halted());
+  EXPECT(Outcome::of(watched) == straight(SUM));
+
+  // IN writes a word too.
+  check::subject = "watched input";
+  Simulator input = loaded(SUM);
+  input.watch(0x000B);
+  input.run_threaded();
+  EXPECT(stopped_at(input, Simulator::Hit::WATCHPOINT, 0x000B, 0));
+  EXPECT(input.instructions() == 0);
+
+  // So does the STORE which patches the program's own code.
+  check::subject = "watched code";
+  Simulator patched = loaded(PATCH);
+  patched.watch(1);
+  patched.run_threaded();
+  EXPECT(stopped_at(patched, Simulator::Hit::WATCHPOINT, 1, 8));
+  EXPECT(patched.memory(1) == 0x300C);
+  patched.unwatch(1);
+  patched.run_threaded();
+  EXPECT(!patched.hit() && patched.halted());
+  EXPECT(Outcome::of(patched) == straight(PATCH));
+
+  return check::status();
+}